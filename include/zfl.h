@@ -35,16 +35,23 @@
 
 //  Classes listed in alphabetical order except for dependencies
 //
+#include <zfl_pool.h>
 #include <zfl_base.h>
 #include <zfl_blob.h>
+#include <zfl_chash.h>
 #include <zfl_config.h>
 #include <zfl_config_json.h>
 #include <zfl_config_zpl.h>
 #include <zfl_device.h>
 #include <zfl_hash.h>
 #include <zfl_list.h>
+#include <zfl_lru.h>
 #include <zfl_msg.h>
+#include <zfl_blob_reader.h>
+#include <zfl_queue.h>
+#include <zfl_ring.h>
 #include <zfl_rpc.h>
 #include <zfl_rpcd.h>
+#include <zfl_time.h>
 
 #endif
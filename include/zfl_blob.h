@@ -36,16 +36,42 @@ zfl_blob_t *
     zfl_blob_new (byte *data, size_t size);
 void
     zfl_blob_destroy (zfl_blob_t **self_p);
+zfl_blob_t *
+    zfl_blob_ref (zfl_blob_t *self);
+void
+    zfl_blob_unref (zfl_blob_t **self_p);
+zfl_blob_t *
+    zfl_blob_slice (zfl_blob_t *self, size_t offset, size_t size);
 size_t
     zfl_blob_load (zfl_blob_t *self, FILE *file);
+size_t
+    zfl_blob_mmap (zfl_blob_t *self, FILE *file);
 int
     zfl_blob_set_data (zfl_blob_t *self, byte *data, size_t size);
 int
     zfl_blob_set_dptr (zfl_blob_t *self, byte *data, size_t size);
+int
+    zfl_blob_reserve (zfl_blob_t *self, size_t size);
+int
+    zfl_blob_append (zfl_blob_t *self, byte *data, size_t size);
+int
+    zfl_blob_append_printf (zfl_blob_t *self, char *format, ...);
+int
+    zfl_blob_append_vprintf (zfl_blob_t *self, char *format, va_list args);
+int
+    zfl_blob_shrink (zfl_blob_t *self);
 byte *
     zfl_blob_data (zfl_blob_t *self);
+byte *
+    zfl_blob_writable (zfl_blob_t *self);
 size_t
     zfl_blob_size (zfl_blob_t *self);
+byte *
+    zfl_blob_find (zfl_blob_t *self, size_t offset, byte value);
+int
+    zfl_blob_compare (zfl_blob_t *self, zfl_blob_t *other);
+qbyte
+    zfl_blob_crc32c (zfl_blob_t *self);
 int
     zfl_blob_test (Bool verbose);
 
@@ -0,0 +1,54 @@
+/*  =========================================================================
+    zfl_blob_reader.h - ZFL chunked blob reader class
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#ifndef __ZFL_BLOB_READER_H_INCLUDED__
+#define __ZFL_BLOB_READER_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zfl_blob_reader_t zfl_blob_reader_t;
+
+zfl_blob_reader_t *
+    zfl_blob_reader_new (FILE *file, size_t chunk_size);
+zfl_blob_reader_t *
+    zfl_blob_reader_new_fd (int fd, size_t chunk_size);
+void
+    zfl_blob_reader_destroy (zfl_blob_reader_t **self_p);
+zfl_blob_t *
+    zfl_blob_reader_next (zfl_blob_reader_t *self);
+zfl_msg_t *
+    zfl_blob_reader_msg (zfl_blob_reader_t *self);
+int
+    zfl_blob_reader_error (zfl_blob_reader_t *self);
+int
+    zfl_blob_reader_test (Bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+/*  =========================================================================
+    zfl_chash.h - ZFL concurrent hash class
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#ifndef __ZFL_CHASH_H_INCLUDED__
+#define __ZFL_CHASH_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Callback function for zfl_chash_apply method
+typedef int (zfl_chash_apply_fn) (char *key, void *value, void *argument);
+//  Callback function for zfl_chash_freefn method
+typedef void (zfl_chash_free_fn) (void *data);
+
+//  Opaque class structure
+typedef struct _zfl_chash_t zfl_chash_t;
+
+zfl_chash_t *
+    zfl_chash_new (size_t shards);
+void
+    zfl_chash_destroy (zfl_chash_t **self_p);
+int
+    zfl_chash_insert (zfl_chash_t *self, char *key, void *value);
+void
+    zfl_chash_delete (zfl_chash_t *self, char *key);
+void *
+    zfl_chash_lookup (zfl_chash_t *self, char *key);
+void *
+    zfl_chash_freefn (zfl_chash_t *self, char *key, zfl_chash_free_fn *free_fn);
+size_t
+    zfl_chash_size (zfl_chash_t *self);
+int
+    zfl_chash_apply (zfl_chash_t *self, zfl_chash_apply_fn *callback, void *argument);
+int
+    zfl_chash_test (Bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
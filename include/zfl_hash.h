@@ -39,6 +39,10 @@ typedef struct _zfl_hash zfl_hash_t;
 
 zfl_hash_t *
     zfl_hash_new (void);
+zfl_hash_t *
+    zfl_hash_new_sized (size_t expected);
+zfl_hash_t *
+    zfl_hash_new_pool (zfl_pool_t *pool);
 void
     zfl_hash_destroy (zfl_hash_t **self_p);
 int
@@ -47,12 +51,48 @@ void
     zfl_hash_delete (zfl_hash_t *self, char *key);
 void *
     zfl_hash_lookup (zfl_hash_t *self, char *key);
+void *
+    zfl_hash_peek (zfl_hash_t *self, char *key);
 void *
     zfl_hash_freefn (zfl_hash_t *self, char *key, zfl_hash_free_fn *free_fn);
+int
+    zfl_hash_insert_bin (zfl_hash_t *self, byte *key, size_t key_size, void *value);
+void
+    zfl_hash_delete_bin (zfl_hash_t *self, byte *key, size_t key_size);
+void *
+    zfl_hash_lookup_bin (zfl_hash_t *self, byte *key, size_t key_size);
+void *
+    zfl_hash_freefn_bin (zfl_hash_t *self, byte *key, size_t key_size,
+                         zfl_hash_free_fn *free_fn);
+int
+    zfl_hash_expiry (zfl_hash_t *self, char *key, int64_t expiry);
+int
+    zfl_hash_expiry_bin (zfl_hash_t *self, byte *key, size_t key_size,
+                         int64_t expiry);
+size_t
+    zfl_hash_expire (zfl_hash_t *self, int64_t now);
+void
+    zfl_hash_set_tick (zfl_hash_t *self, int64_t tick);
+size_t
+    zfl_hash_insert_batch (zfl_hash_t *self, char **keys, void **values,
+                           size_t count);
+void
+    zfl_hash_lookup_batch (zfl_hash_t *self, char **keys, void **values,
+                           size_t count);
 size_t
     zfl_hash_size (zfl_hash_t *self);
 int
     zfl_hash_apply (zfl_hash_t *self, zfl_hash_apply_fn *callback, void *argument);
+void *
+    zfl_hash_first (zfl_hash_t *self);
+void *
+    zfl_hash_next (zfl_hash_t *self);
+char *
+    zfl_hash_cursor (zfl_hash_t *self);
+void
+    zfl_hash_done (zfl_hash_t *self);
+qbyte
+    zfl_hash_key_hash (zfl_hash_t *self, byte *key, size_t key_size);
 void
     zfl_hash_test (int verbose);
 
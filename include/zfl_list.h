@@ -1,5 +1,5 @@
 /*  =========================================================================
-    zfl_list.h - ZFL singly-linked list class
+    zfl_list.h - ZFL doubly-linked list class
 
     -------------------------------------------------------------------------
     Copyright (c) 1991-2010 iMatix Corporation <www.imatix.com>
@@ -31,19 +31,39 @@ extern "C" {
 
 //  Opaque class structure
 typedef struct _zfl_list zfl_list_t;
+//  Opaque handle to a list node
+typedef struct _zfl_list_handle zfl_list_handle_t;
+//  Comparator function for zfl_list_insert_sorted method, like strcmp
+typedef int (zfl_list_compare_fn) (void *value1, void *value2);
 
 zfl_list_t *
     zfl_list_new (void);
+zfl_list_t *
+    zfl_list_new_pool (zfl_pool_t *pool);
 void
     zfl_list_destroy (zfl_list_t **self_p);
 void *
     zfl_list_first (zfl_list_t *self);
-void
+void *
+    zfl_list_next (zfl_list_t *self);
+zfl_list_handle_t *
+    zfl_list_cursor (zfl_list_t *self);
+zfl_list_handle_t *
     zfl_list_append (zfl_list_t *self, void *value);
-void
+zfl_list_handle_t *
     zfl_list_push (zfl_list_t *self, void *value);
+zfl_list_handle_t *
+    zfl_list_insert_sorted (zfl_list_t *self, void *value, zfl_list_compare_fn *compare);
+void *
+    zfl_list_pop (zfl_list_t *self);
 void
     zfl_list_remove (zfl_list_t *self, void *value);
+void
+    zfl_list_remove_handle (zfl_list_t *self, zfl_list_handle_t *handle);
+void
+    zfl_list_move_tail (zfl_list_t *self, zfl_list_handle_t *handle);
+void
+    zfl_list_set_freelist (zfl_list_t *self, size_t max_nodes);
 zfl_list_t *
     zfl_list_copy (zfl_list_t *self);
 size_t
@@ -0,0 +1,66 @@
+/*  =========================================================================
+    zfl_lru.h - ZFL LRU cache class
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#ifndef __ZFL_LRU_H_INCLUDED__
+#define __ZFL_LRU_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zfl_lru_t zfl_lru_t;
+
+zfl_lru_t *
+    zfl_lru_new (size_t max_items, size_t max_bytes);
+void
+    zfl_lru_destroy (zfl_lru_t **self_p);
+void
+    zfl_lru_freefn (zfl_lru_t *self, zfl_hash_free_fn *free_fn);
+int
+    zfl_lru_put (zfl_lru_t *self, char *key, void *value, size_t bytes);
+void *
+    zfl_lru_get (zfl_lru_t *self, char *key);
+int
+    zfl_lru_touch (zfl_lru_t *self, char *key);
+void
+    zfl_lru_delete (zfl_lru_t *self, char *key);
+size_t
+    zfl_lru_size (zfl_lru_t *self);
+size_t
+    zfl_lru_bytes (zfl_lru_t *self);
+size_t
+    zfl_lru_hits (zfl_lru_t *self);
+size_t
+    zfl_lru_misses (zfl_lru_t *self);
+size_t
+    zfl_lru_evictions (zfl_lru_t *self);
+int
+    zfl_lru_test (Bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
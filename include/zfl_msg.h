@@ -34,14 +34,24 @@ typedef struct _zfl_msg_t zfl_msg_t;
 
 zfl_msg_t *
     zfl_msg_new (void);
+zfl_msg_t *
+    zfl_msg_new_pool (zfl_pool_t *pool);
+void
+    zfl_msg_set_binary_ids (zfl_msg_t *self, Bool binary);
 void
     zfl_msg_destroy (zfl_msg_t **self_p);
+void
+    zfl_msg_reset (zfl_msg_t *self);
 zfl_msg_t *
     zfl_msg_dup (zfl_msg_t *self);
 zfl_msg_t *
     zfl_msg_recv (void *socket);
+void
+    zfl_msg_recv_into (zfl_msg_t *self, void *socket);
 void
     zfl_msg_send (zfl_msg_t **self, void *socket);
+void
+    zfl_msg_send_keep (zfl_msg_t *self, void *socket);
 size_t
     zfl_msg_parts (zfl_msg_t *self);
 char
@@ -50,14 +60,24 @@ size_t
     zfl_msg_body_size (zfl_msg_t *self);
 void
     zfl_msg_body_set (zfl_msg_t *self, char *body);
+void
+    zfl_msg_body_set_data (zfl_msg_t *self, byte *data, size_t size);
+byte
+    *zfl_msg_body_alloc (zfl_msg_t *self, size_t size);
+void
+    zfl_msg_body_truncate (zfl_msg_t *self, size_t size);
 void
     zfl_msg_body_fmt (zfl_msg_t *self, char *format, ...);
 void
     zfl_msg_push (zfl_msg_t *self, char *part);
+void
+    zfl_msg_push_data (zfl_msg_t *self, byte *data, size_t size);
 char
     *zfl_msg_pop (zfl_msg_t *self);
 char
     *zfl_msg_address (zfl_msg_t *self);
+size_t
+    zfl_msg_address_size (zfl_msg_t *self);
 void
     zfl_msg_wrap (zfl_msg_t *self, char *address, char *delim);
 char
@@ -0,0 +1,54 @@
+/*  =========================================================================
+    zfl_pool.h - ZFL memory pool class
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#ifndef __ZFL_POOL_H_INCLUDED__
+#define __ZFL_POOL_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zfl_pool_t zfl_pool_t;
+
+zfl_pool_t *
+    zfl_pool_new (void);
+void
+    zfl_pool_destroy (zfl_pool_t **self_p);
+void *
+    zfl_pool_alloc (zfl_pool_t *self, size_t size);
+void
+    zfl_pool_free (zfl_pool_t *self, void *data);
+char *
+    zfl_pool_strdup (zfl_pool_t *self, char *string);
+size_t
+    zfl_pool_chunks (zfl_pool_t *self);
+int
+    zfl_pool_test (Bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+/*  =========================================================================
+    zfl_queue.h - ZFL chunked queue class
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#ifndef __ZFL_QUEUE_H_INCLUDED__
+#define __ZFL_QUEUE_H_INCLUDED__
+
+//  What to do when adding to a queue that is at its high-water mark
+#define ZFL_QUEUE_DROP      1       //  Refuse the new value
+#define ZFL_QUEUE_BLOCK     2       //  Wait until another thread pops
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zfl_queue_t zfl_queue_t;
+
+zfl_queue_t *
+    zfl_queue_new (void);
+void
+    zfl_queue_destroy (zfl_queue_t **self_p);
+void
+    zfl_queue_set_hwm (zfl_queue_t *self, size_t hwm, int policy);
+int
+    zfl_queue_append (zfl_queue_t *self, void *value);
+int
+    zfl_queue_push (zfl_queue_t *self, void *value);
+void *
+    zfl_queue_pop (zfl_queue_t *self);
+void *
+    zfl_queue_pop_tail (zfl_queue_t *self);
+void *
+    zfl_queue_first (zfl_queue_t *self);
+size_t
+    zfl_queue_size (zfl_queue_t *self);
+int
+    zfl_queue_test (Bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+/*  =========================================================================
+    zfl_ring.h - ZFL lock-free ring class
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#ifndef __ZFL_RING_H_INCLUDED__
+#define __ZFL_RING_H_INCLUDED__
+
+//  Ring types
+#define ZFL_RING_SPSC       1       //  One producer, one consumer thread
+#define ZFL_RING_MPMC       2       //  Any number of either
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zfl_ring_t zfl_ring_t;
+
+zfl_ring_t *
+    zfl_ring_new (size_t size, int type);
+void
+    zfl_ring_destroy (zfl_ring_t **self_p);
+int
+    zfl_ring_push (zfl_ring_t *self, void *value);
+void *
+    zfl_ring_pop (zfl_ring_t *self);
+size_t
+    zfl_ring_push_batch (zfl_ring_t *self, void **values, size_t count);
+size_t
+    zfl_ring_pop_batch (zfl_ring_t *self, void **values, size_t count);
+size_t
+    zfl_ring_size (zfl_ring_t *self);
+int
+    zfl_ring_test (Bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
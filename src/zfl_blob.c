@@ -3,7 +3,10 @@
 
     Manipulates opaque binary objects including reading and writing from/to
     files.  Example use case is for loading config data from stdin or file
-    for processing by zfl_config.
+    for processing by zfl_config.  Large files can be mapped into memory
+    rather than read, so that loading them costs no copy at all.  Blobs can
+    also be built up piece by piece; the buffer grows geometrically so that
+    appending takes amortized constant time per byte.
 
     -------------------------------------------------------------------------
     Copyright (c) 1991-2010 iMatix Corporation <www.imatix.com>
@@ -28,6 +31,30 @@
 
 #include "../include/zfl_prelude.h"
 #include "../include/zfl_blob.h"
+#if defined (__UNIX__)
+#   include <sys/mman.h>
+#endif
+#if defined (__GNUC__) && defined (__x86_64__)
+#   include <nmmintrin.h>
+#   define CRC32C_HARDWARE              //  SSE4.2 crc32 instruction
+#endif
+
+#define READ_CHUNK      4096    //  Initial buffer when reading a stream
+
+//  Buffer holding blob data, which blobs can share. The data either
+//  follows the buffer header, or is a file mapping.
+
+typedef struct {
+    volatile long
+        refs;                   //  Blobs using this buffer
+    byte
+        *map;                   //  File mapping, if any
+    size_t
+        map_size,               //  Size of file mapping
+        capacity;               //  Room for data, not counting null byte
+    byte
+        data [];                //  Else, the data itself
+} buffer_t;
 
 //  Structure of our class
 
@@ -35,11 +62,162 @@ struct _zfl_blob_t {
     size_t
         size;                   //  Blob data size
     byte
-        *data,                  //  Content of our blob
-        *dptr;                  //  Or, pointer to data
+        *data;                  //  Start of blob data
+    buffer_t
+        *buffer;                //  Buffer holding data, or NULL if the
+                                //  data is borrowed from the caller
 };
 
 
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Count references to a buffer; these are atomic so that blobs sharing a
+//  buffer can be used, and destroyed, in different threads.
+
+#if defined (__GNUC__)
+static inline void
+s_buffer_ref (buffer_t *buffer)
+{
+    __atomic_add_fetch (&buffer->refs, 1, __ATOMIC_RELAXED);
+}
+
+static inline Bool
+s_buffer_unref (buffer_t *buffer)
+{
+    return __atomic_sub_fetch (&buffer->refs, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+static inline long
+s_buffer_refs (buffer_t *buffer)
+{
+    return __atomic_load_n (&buffer->refs, __ATOMIC_ACQUIRE);
+}
+#elif defined (__WINDOWS__)
+static inline void
+s_buffer_ref (buffer_t *buffer)
+{
+    InterlockedIncrement (&buffer->refs);
+}
+
+static inline Bool
+s_buffer_unref (buffer_t *buffer)
+{
+    return InterlockedDecrement (&buffer->refs) == 0;
+}
+
+static inline long
+s_buffer_refs (buffer_t *buffer)
+{
+    return InterlockedCompareExchange (&buffer->refs, 0, 0);
+}
+#else
+#   error "Platform not supported by zfl_blob class"
+#endif
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Allocate a buffer with room for size bytes of data plus a null byte
+
+static buffer_t *
+s_buffer_new (size_t size)
+{
+    buffer_t *buffer = (buffer_t *) malloc (sizeof (buffer_t) + size + 1);
+    assert (buffer);
+    buffer->refs = 1;
+    buffer->map = NULL;
+    buffer->map_size = 0;
+    buffer->capacity = size;
+    return buffer;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Drop the blob's data, releasing its buffer if no other blob uses it;
+//  and attach a new buffer to the blob.
+
+static void
+s_release (zfl_blob_t *self)
+{
+    buffer_t *buffer = self->buffer;
+    if (buffer && s_buffer_unref (buffer)) {
+#if defined (__UNIX__)
+        if (buffer->map)
+            munmap (buffer->map, buffer->map_size);
+#endif
+        free (buffer);
+    }
+    self->buffer = NULL;
+    self->data = NULL;
+    self->size = 0;
+}
+
+static void
+s_attach (zfl_blob_t *self, buffer_t *buffer, size_t size)
+{
+    s_release (self);
+    self->buffer = buffer;
+    self->data = buffer->map? buffer->map: buffer->data;
+    self->size = size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  A blob can grow in place if it is the only user of a heap buffer, and
+//  its data starts at the start of the buffer. When we grow a blob, we at
+//  least double its size, so appending costs amortized constant time.
+
+static Bool
+s_growable (zfl_blob_t *self)
+{
+    return self->buffer
+        && self->buffer->map == NULL
+        && self->data == self->buffer->data
+        && s_buffer_refs (self->buffer) == 1;
+}
+
+static void
+s_grow (zfl_blob_t *self, size_t needed)
+{
+    if (!s_growable (self) || needed > self->buffer->capacity) {
+        size_t capacity = self->size * 2;
+        if (capacity < needed)
+            capacity = needed;
+        zfl_blob_reserve (self, capacity);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Read the rest of a stream that we can't seek, such as a pipe or stdin,
+//  into a buffer that doubles as needed. Returns the buffer, with a null
+//  byte after the data, and the size of the data in *size_p.
+
+static buffer_t *
+s_read_stream (FILE *file, size_t *size_p)
+{
+    size_t limit = READ_CHUNK;
+    size_t size = 0;
+    buffer_t *buffer = s_buffer_new (limit);
+    FOREVER {
+        size_t rc = fread (buffer->data + size, 1, limit - size, file);
+        size += rc;
+        if (size < limit)
+            break;
+        limit *= 2;
+        buffer = (buffer_t *) realloc (buffer, sizeof (buffer_t) + limit + 1);
+        assert (buffer);
+        buffer->capacity = limit;
+    }
+    buffer->data [size] = 0;
+    *size_p = size;
+    return buffer;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Constructor
 
@@ -58,6 +236,8 @@ zfl_blob_new (byte *data, size_t size)
 
 //  --------------------------------------------------------------------------
 //  Destructor
+//  If other blobs share the blob's data, the data lives on until the last
+//  of them is destroyed.
 
 void
 zfl_blob_destroy (zfl_blob_t **self_p)
@@ -65,18 +245,74 @@ zfl_blob_destroy (zfl_blob_t **self_p)
     assert (self_p);
     if (*self_p) {
         zfl_blob_t *self = *self_p;
-        zfree (self->data);
+        s_release (self);
         free (self);
         *self_p = NULL;
     }
 }
 
 
+//  --------------------------------------------------------------------------
+//  Returns a new blob that shares the data of this blob, without copying
+//  it. Both blobs stay valid until destroyed, in any order, and may be
+//  used in different threads. If the blob holds data borrowed with
+//  zfl_blob_set_dptr, the new blob gets its own copy instead, since we
+//  don't control the lifetime of that data.
+
+zfl_blob_t *
+zfl_blob_ref (zfl_blob_t *self)
+{
+    assert (self);
+    zfl_blob_t *copy = zfl_blob_new (NULL, 0);
+    if (self->buffer) {
+        s_buffer_ref (self->buffer);
+        copy->buffer = self->buffer;
+        copy->data = self->data;
+        copy->size = self->size;
+    }
+    else
+    if (self->data)
+        zfl_blob_set_data (copy, self->data, self->size);
+
+    return copy;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destroys a blob reference; same as zfl_blob_destroy, provided so that
+//  code can pair it with zfl_blob_ref.
+
+void
+zfl_blob_unref (zfl_blob_t **self_p)
+{
+    zfl_blob_destroy (self_p);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Returns a new blob holding size bytes of this blob's data, starting at
+//  offset, and sharing the data as zfl_blob_ref does. Unlike other blobs,
+//  a slice that ends before the end of its parent is not followed by a
+//  null byte.
+
+zfl_blob_t *
+zfl_blob_slice (zfl_blob_t *self, size_t offset, size_t size)
+{
+    assert (self);
+    assert (offset + size <= self->size);
+    zfl_blob_t *slice = zfl_blob_ref (self);
+    slice->data += offset;
+    slice->size = size;
+    return slice;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Loads blob from file.  Always adds a binary zero to end of blob data so
 //  that it can be parsed as a string if necessary.  Returns size of blob
 //  data.  Idempotent, does not change current read position in file. If
-//  file cannot be read, returns empty blob.
+//  the file is a pipe or other stream we can't seek, reads the rest of the
+//  stream instead. Reads the data straight into the blob, without copying.
 
 size_t
 zfl_blob_load (zfl_blob_t *self, FILE *file)
@@ -84,6 +320,10 @@ zfl_blob_load (zfl_blob_t *self, FILE *file)
     long
         posn,                   //  Current position in file
         size;                   //  Size of file data
+    buffer_t
+        *buffer;                //  Data we read
+    size_t
+        buffer_size;            //  Amount of data we read
 
     //  Get current position in file so we can come back here afterwards
     posn = ftell (file);
@@ -93,22 +333,63 @@ zfl_blob_load (zfl_blob_t *self, FILE *file)
         assert (size >= 0);
 
         //  Read file data, and then reset file position
-        byte *buffer = (byte *) malloc (size);
+        buffer = s_buffer_new (size);
         fseek (file, 0, SEEK_SET);
-        size_t rc = fread (buffer, 1, size, file);
-        assert (rc == size);
+        buffer_size = fread (buffer->data, 1, size, file);
+        buffer->data [buffer_size] = 0;
         fseek (file, posn, SEEK_SET);
-
-        zfl_blob_set_data (self, buffer, size);
-        free (buffer);
     }
     else
-        zfl_blob_set_data (self, NULL, 0);
+        buffer = s_read_stream (file, &buffer_size);
 
+    s_attach (self, buffer, buffer_size);
     return zfl_blob_size (self);
 }
 
 
+//  --------------------------------------------------------------------------
+//  Maps file into memory as blob data, so that loading a large file costs
+//  neither a copy nor memory beyond the pages you touch. The mapping is
+//  private: you can modify the blob data, e.g. to parse it in place, but
+//  changes don't go back to the file. The blob data always ends with a
+//  binary zero, as for zfl_blob_load. If the file can't be mapped, e.g. it
+//  is a pipe, or has no spare byte after the data, loads it instead.
+//  Returns size of blob data. The mapping is released when you destroy the
+//  blob or set new data.
+
+size_t
+zfl_blob_mmap (zfl_blob_t *self, FILE *file)
+{
+    assert (self);
+    assert (file);
+#if defined (__UNIX__)
+    struct stat stat_buf;
+    if (fstat (fileno (file), &stat_buf) == 0
+    &&  S_ISREG (stat_buf.st_mode)
+    &&  stat_buf.st_size > 0) {
+        //  The bytes between the end of a file and the end of its last
+        //  page read as zero, which gives us our terminating null unless
+        //  the file fills the whole page.
+        size_t size = (size_t) stat_buf.st_size;
+        size_t page_size = (size_t) sysconf (_SC_PAGESIZE);
+        if (size % page_size) {
+            void *map = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE, fileno (file), 0);
+            if (map != MAP_FAILED) {
+                buffer_t *buffer = s_buffer_new (0);
+                buffer->capacity = 0;
+                buffer->map = (byte *) map;
+                buffer->map_size = size;
+                s_attach (self, buffer, size);
+                return zfl_blob_size (self);
+            }
+        }
+    }
+#endif
+    return zfl_blob_load (self, file);
+}
+
+
 //  --------------------------------------------------------------------------
 //  Sets blob data as specified.  Always appends a null byte to the data.
 //  Data is copied to blob. Use like this:
@@ -121,17 +402,15 @@ zfl_blob_set_data (zfl_blob_t *self, byte *data, size_t size)
 {
     assert (self);
 
-    zfree (self->data);
-    self->dptr = NULL;          //  No data reference
-    self->size = size;
     if (data) {
-        self->data = (byte *) malloc (size + 1);
-        memcpy (self->data, data, size);
-        self->data [size] = 0;
+        buffer_t *buffer = s_buffer_new (size);
+        memcpy (buffer->data, data, size);
+        buffer->data [size] = 0;
+        s_attach (self, buffer, size);
     }
     else {
         assert (size == 0);
-        self->data = NULL;
+        s_release (self);
     }
     return 0;
 }
@@ -148,8 +427,8 @@ zfl_blob_set_dptr (zfl_blob_t *self, byte *data, size_t size)
 {
     assert (self);
 
-    zfree (self->data);         //  Free any copied data
-    self->dptr = data;          //  Hold data reference
+    s_release (self);           //  Free any copied data
+    self->data = data;          //  Hold data reference
     self->size = size;
 
     return 0;
@@ -157,13 +436,157 @@ zfl_blob_set_dptr (zfl_blob_t *self, byte *data, size_t size)
 
 
 //  --------------------------------------------------------------------------
-//  Returns pointer to blob data.
+//  Returns pointer to blob data. If the blob shares its data with other
+//  blobs, you must not modify the data through this pointer; use
+//  zfl_blob_writable instead.
 
 byte *
 zfl_blob_data (zfl_blob_t *self)
 {
     assert (self);
-    return self->data? self->data: self->dptr;
+    return self->data;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Returns pointer to blob data that you may modify. If the blob shares its
+//  data with other blobs, or borrows it from the caller, first gives the
+//  blob its own copy of the data, followed by a null byte. Otherwise, costs
+//  nothing.
+
+byte *
+zfl_blob_writable (zfl_blob_t *self)
+{
+    assert (self);
+    if (self->data
+    && (self->buffer == NULL || s_buffer_refs (self->buffer) > 1)) {
+        buffer_t *buffer = s_buffer_new (self->size);
+        memcpy (buffer->data, self->data, self->size);
+        buffer->data [self->size] = 0;
+        s_attach (self, buffer, self->size);
+    }
+    return self->data;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Makes sure the blob can hold at least size bytes of data, plus a null
+//  byte, without reallocating, and that it doesn't share its data with
+//  other blobs. Use this before many appends if you know the final size.
+//  This may move the blob data.
+
+int
+zfl_blob_reserve (zfl_blob_t *self, size_t size)
+{
+    assert (self);
+    if (s_growable (self)) {
+        if (size > self->buffer->capacity) {
+            buffer_t *buffer = (buffer_t *) realloc (self->buffer,
+                sizeof (buffer_t) + size + 1);
+            assert (buffer);
+            buffer->capacity = size;
+            self->buffer = buffer;
+            self->data = buffer->data;
+        }
+    }
+    else {
+        if (size < self->size)
+            size = self->size;
+        buffer_t *buffer = s_buffer_new (size);
+        if (self->size)
+            memcpy (buffer->data, self->data, self->size);
+        buffer->data [self->size] = 0;
+        s_attach (self, buffer, self->size);
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Appends data to the blob, growing it as needed. Always keeps a null byte
+//  after the blob data. If the blob shares its data, it gets its own copy
+//  first. This may move the blob data.
+
+int
+zfl_blob_append (zfl_blob_t *self, byte *data, size_t size)
+{
+    assert (self);
+    assert (data || size == 0);
+
+    s_grow (self, self->size + size);
+    if (size)
+        memcpy (self->data + self->size, data, size);
+    self->size += size;
+    self->data [self->size] = 0;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Appends a string formatted using printf syntax, growing the blob as
+//  needed; the string is never truncated.
+
+int
+zfl_blob_append_printf (zfl_blob_t *self, char *format, ...)
+{
+    va_list args;
+
+    va_start (args, format);
+    int rc = zfl_blob_append_vprintf (self, format, args);
+    va_end (args);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Appends a string formatted using vprintf syntax, for callers that take
+//  a variable argument list themselves.
+
+int
+zfl_blob_append_vprintf (zfl_blob_t *self, char *format, va_list args)
+{
+    assert (self);
+    assert (format);
+
+    //  Format into the space we have, if any, then grow and format again
+    //  if the string didn't fit
+    va_list retry;
+    va_copy (retry, args);
+    char *target = NULL;
+    size_t room = 0;
+    if (s_growable (self)) {
+        target = (char *) self->data + self->size;
+        room = self->buffer->capacity - self->size + 1;
+    }
+    int length = vsnprintf (target, room, format, args);
+    assert (length >= 0);
+    if ((size_t) length >= room) {
+        s_grow (self, self->size + length);
+        vsnprintf ((char *) self->data + self->size, length + 1, format, retry);
+    }
+    va_end (retry);
+    self->size += length;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Releases any spare room in the blob's buffer, once you've finished
+//  building the blob. This may move the blob data.
+
+int
+zfl_blob_shrink (zfl_blob_t *self)
+{
+    assert (self);
+    if (s_growable (self) && self->buffer->capacity > self->size) {
+        buffer_t *buffer = (buffer_t *) realloc (self->buffer,
+            sizeof (buffer_t) + self->size + 1);
+        assert (buffer);
+        buffer->capacity = self->size;
+        self->buffer = buffer;
+        self->data = buffer->data;
+    }
+    return 0;
 }
 
 
@@ -178,6 +601,143 @@ zfl_blob_size (zfl_blob_t *self)
 }
 
 
+//  --------------------------------------------------------------------------
+//  Returns pointer to the first occurrence of value in the blob data at or
+//  after offset, or NULL if there is none. Use this to split data at
+//  newlines or other delimiters. We use memchr, which the C library already
+//  implements with the widest vector instructions the CPU supports.
+
+byte *
+zfl_blob_find (zfl_blob_t *self, size_t offset, byte value)
+{
+    assert (self);
+    if (offset >= self->size)
+        return NULL;
+    return (byte *) memchr (self->data + offset, value, self->size - offset);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Compares two blobs byte by byte, like memcmp; if one blob is a prefix
+//  of the other, the shorter one sorts first. Returns less than, equal to,
+//  or greater than zero.
+
+int
+zfl_blob_compare (zfl_blob_t *self, zfl_blob_t *other)
+{
+    assert (self);
+    assert (other);
+    size_t size = self->size < other->size? self->size: other->size;
+    int rc = size? memcmp (self->data, other->data, size): 0;
+    if (rc == 0 && self->size != other->size)
+        rc = self->size < other->size? -1: 1;
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Compute CRC-32C (Castagnoli), with the SSE4.2 crc32 instruction if the
+//  CPU has it, else a byte at a time from a table.
+
+static const qbyte
+    s_crc32c_table [256] = {
+    0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C,
+    0x26A1E7E8, 0xD4CA64EB, 0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B,
+    0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24, 0x105EC76F, 0xE235446C,
+    0xF165B798, 0x030E349B, 0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+    0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54, 0x5D1D08BF, 0xAF768BBC,
+    0xBC267848, 0x4E4DFB4B, 0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A,
+    0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35, 0xAA64D611, 0x580F5512,
+    0x4B5FA6E6, 0xB93425E5, 0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+    0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45, 0xF779DEAE, 0x05125DAD,
+    0x1642AE59, 0xE4292D5A, 0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A,
+    0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595, 0x417B1DBC, 0xB3109EBF,
+    0xA0406D4B, 0x522BEE48, 0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+    0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687, 0x0C38D26C, 0xFE53516F,
+    0xED03A29B, 0x1F682198, 0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927,
+    0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38, 0xDBFC821C, 0x2997011F,
+    0x3AC7F2EB, 0xC8AC71E8, 0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+    0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096, 0xA65C047D, 0x5437877E,
+    0x4767748A, 0xB50CF789, 0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859,
+    0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46, 0x7198540D, 0x83F3D70E,
+    0x90A324FA, 0x62C8A7F9, 0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+    0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36, 0x3CDB9BDD, 0xCEB018DE,
+    0xDDE0EB2A, 0x2F8B6829, 0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C,
+    0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93, 0x082F63B7, 0xFA44E0B4,
+    0xE9141340, 0x1B7F9043, 0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+    0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3, 0x55326B08, 0xA759E80B,
+    0xB4091BFF, 0x466298FC, 0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C,
+    0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033, 0xA24BB5A6, 0x502036A5,
+    0x4370C551, 0xB11B4652, 0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+    0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D, 0xEF087A76, 0x1D63F975,
+    0x0E330A81, 0xFC588982, 0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D,
+    0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622, 0x38CC2A06, 0xCAA7A905,
+    0xD9F75AF1, 0x2B9CD9F2, 0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+    0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530, 0x0417B1DB, 0xF67C32D8,
+    0xE52CC12C, 0x1747422F, 0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF,
+    0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0, 0xD3D3E1AB, 0x21B862A8,
+    0x32E8915C, 0xC083125F, 0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+    0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90, 0x9E902E7B, 0x6CFBAD78,
+    0x7FAB5E8C, 0x8DC0DD8F, 0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE,
+    0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1, 0x69E9F0D5, 0x9B8273D6,
+    0x88D28022, 0x7AB90321, 0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+    0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69,
+    0xD5CF889D, 0x27A40B9E, 0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E,
+    0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351
+
+    };
+
+static qbyte
+s_crc32c_table_update (qbyte crc, byte *data, size_t size)
+{
+    while (size--)
+        crc = s_crc32c_table [(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined (CRC32C_HARDWARE)
+__attribute__ ((target ("sse4.2"))) static qbyte
+s_crc32c_hardware_update (qbyte crc, byte *data, size_t size)
+{
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy (&word, data, 8);
+        crc64 = _mm_crc32_u64 (crc64, word);
+        data += 8;
+        size -= 8;
+    }
+    crc = (qbyte) crc64;
+    while (size--)
+        crc = _mm_crc32_u8 (crc, *data++);
+    return crc;
+}
+#endif
+
+static qbyte
+s_crc32c_update (qbyte crc, byte *data, size_t size)
+{
+#if defined (CRC32C_HARDWARE)
+    if (__builtin_cpu_supports ("sse4.2"))
+        return s_crc32c_hardware_update (crc, data, size);
+#endif
+    return s_crc32c_table_update (crc, data, size);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Returns CRC-32C checksum of blob data, as used by iSCSI, SCTP and ext4.
+//  Use this to check data has not been corrupted in storage or transit.
+
+qbyte
+zfl_blob_crc32c (zfl_blob_t *self)
+{
+    assert (self);
+    return ~s_crc32c_update (0xFFFFFFFF, self->data, self->size);
+}
+
+
 //  --------------------------------------------------------------------------
 //  Selftest
 
@@ -199,13 +759,142 @@ zfl_blob_test (Bool verbose)
     file = fopen ("zfl_blob.c", "r");
     assert (file);
     assert (zfl_blob_load (blob, file));
+
+    //  Mapping the file gives the same data, which we can modify in place
+    zfl_blob_t *mapped = zfl_blob_new (NULL, 0);
+    size_t mapped_size = zfl_blob_mmap (mapped, file);
+    assert (mapped_size == zfl_blob_size (blob));
     fclose (file);
+    assert (memcmp (zfl_blob_data (mapped), zfl_blob_data (blob),
+                    zfl_blob_size (blob) + 1) == 0);
+    zfl_blob_writable (mapped) [0] = '#';
+    zfl_blob_destroy (&mapped);
 
     assert (zfl_blob_size (blob) > 0);
     zfl_blob_set_data (blob, (byte *) string, strlen (string));
     assert (zfl_blob_size (blob) == strlen (string));
     assert (streq ((char *) (zfl_blob_data (blob)), string));
 
+    //  References and slices share data until one of them writes to it
+    zfl_blob_t *ref = zfl_blob_ref (blob);
+    zfl_blob_t *slice = zfl_blob_slice (blob, 5, 2);
+    assert (zfl_blob_data (ref) == zfl_blob_data (blob));
+    assert (zfl_blob_data (slice) == zfl_blob_data (blob) + 5);
+    assert (zfl_blob_size (slice) == 2);
+    byte *data = zfl_blob_writable (ref);
+    assert (data != zfl_blob_data (blob));
+    data [0] = 't';
+    assert (streq ((char *) (zfl_blob_data (ref)), "this is a string"));
+    assert (streq ((char *) (zfl_blob_data (blob)), string));
+    zfl_blob_unref (&blob);
+    assert (memcmp (zfl_blob_data (slice), "is", 2) == 0);
+    data = zfl_blob_data (slice);
+    assert (zfl_blob_writable (slice) == data);
+    zfl_blob_unref (&slice);
+
+    //  Borrowed data is never shared, and never written to
+    blob = zfl_blob_new (NULL, 0);
+    zfl_blob_set_dptr (blob, (byte *) string, strlen (string) + 1);
+    zfl_blob_destroy (&ref);
+    ref = zfl_blob_ref (blob);
+    assert (zfl_blob_data (ref) != zfl_blob_data (blob));
+    assert (streq ((char *) (zfl_blob_data (ref)), string));
+    assert (zfl_blob_writable (blob) != (byte *) string);
+    zfl_blob_destroy (&ref);
+
+    //  Build a large blob piece by piece; growing it geometrically means we
+    //  move the data only a handful of times
+    zfl_blob_set_data (blob, NULL, 0);
+    int moves = 0;
+    int item_nbr;
+    for (item_nbr = 0; item_nbr < 10000; item_nbr++) {
+        data = zfl_blob_data (blob);
+        zfl_blob_append_printf (blob, "%04d,", item_nbr);
+        if (zfl_blob_data (blob) != data)
+            moves++;
+    }
+    assert (zfl_blob_size (blob) == 50000);
+    assert (strlen ((char *) zfl_blob_data (blob)) == 50000);
+    assert (memcmp (zfl_blob_data (blob) + 49995, "9999,", 5) == 0);
+    assert (moves < 20);
+    zfl_blob_shrink (blob);
+    assert (zfl_blob_size (blob) == 50000);
+
+    //  Appending to shared data copies it first
+    ref = zfl_blob_ref (blob);
+    zfl_blob_append (ref, (byte *) "!", 1);
+    assert (zfl_blob_size (ref) == 50001);
+    assert (zfl_blob_size (blob) == 50000);
+    assert (zfl_blob_data (blob) [50000] == 0);
+    zfl_blob_destroy (&ref);
+
+    //  Reserving room means appends don't move the data
+    zfl_blob_set_data (blob, NULL, 0);
+    zfl_blob_reserve (blob, 1000);
+    data = zfl_blob_data (blob);
+    for (item_nbr = 0; item_nbr < 100; item_nbr++)
+        zfl_blob_append (blob, (byte *) "0123456789", 10);
+    assert (zfl_blob_data (blob) == data);
+    zfl_blob_append_printf (blob, "%s", "");
+    assert (zfl_blob_size (blob) == 1000);
+
+    //  Find delimiters, and compare blobs
+    byte *found = zfl_blob_find (blob, 0, '5');
+    assert (found == zfl_blob_data (blob) + 5);
+    found = zfl_blob_find (blob, 996, '5');
+    assert (found == NULL);
+    assert (zfl_blob_find (blob, 1000, 0) == NULL);
+    ref = zfl_blob_slice (blob, 10, 10);
+    assert (zfl_blob_compare (blob, ref) > 0);
+    assert (zfl_blob_compare (ref, blob) < 0);
+    zfl_blob_destroy (&ref);
+    ref = zfl_blob_ref (blob);
+    assert (zfl_blob_compare (blob, ref) == 0);
+    zfl_blob_writable (ref) [999] = 'x';
+    assert (zfl_blob_compare (blob, ref) < 0);
+    zfl_blob_destroy (&ref);
+
+    //  CRC-32C check value, and hardware matches table at every alignment
+    ref = zfl_blob_new ((byte *) "123456789", 9);
+    assert (zfl_blob_crc32c (ref) == 0xE3069283);
+    zfl_blob_destroy (&ref);
+    data = zfl_blob_data (blob);
+    for (item_nbr = 0; item_nbr < 16; item_nbr++)
+        assert (s_crc32c_update (0, data + item_nbr, 100 + item_nbr)
+            == s_crc32c_table_update (0, data + item_nbr, 100 + item_nbr));
+
+#if defined (__UNIX__)
+    //  A file that fills its last page gets loaded rather than mapped,
+    //  so that its data still ends with a null byte
+    size_t page_size = (size_t) sysconf (_SC_PAGESIZE);
+    file = fopen ("zfl_blob_selftest.tmp", "w+");
+    assert (file);
+    byte *page = (byte *) malloc (page_size);
+    memset (page, 'x', page_size);
+    size_t written = fwrite (page, 1, page_size, file);
+    assert (written == page_size);
+    fflush (file);
+    mapped_size = zfl_blob_mmap (blob, file);
+    assert (mapped_size == page_size);
+    assert (zfl_blob_data (blob) [page_size] == 0);
+    fclose (file);
+    free (page);
+    remove ("zfl_blob_selftest.tmp");
+
+    //  Pipes and other streams are read to the end
+    int fds [2];
+    int rc = pipe (fds);
+    assert (rc == 0);
+    ssize_t piped = write (fds [1], string, strlen (string));
+    assert (piped == (ssize_t) strlen (string));
+    close (fds [1]);
+    file = fdopen (fds [0], "r");
+    mapped_size = zfl_blob_mmap (blob, file);
+    assert (mapped_size == strlen (string));
+    assert (streq ((char *) (zfl_blob_data (blob)), string));
+    fclose (file);
+#endif
+
     zfl_blob_destroy (&blob);
     assert (blob == NULL);
 
@@ -0,0 +1,392 @@
+/*  =========================================================================
+    zfl_blob_reader.c - chunked blob reader
+
+    Reads a file, pipe or other stream as a series of fixed-size chunks, so
+    that you can process or send data larger than memory while holding one
+    chunk at a time. Each chunk is a blob that borrows the reader's buffer,
+    so reading a chunk costs no copy beyond the read itself. Where the
+    system supports it, we tell the kernel we're reading sequentially and
+    ask it to read ahead of us, so that the next chunk is usually in memory
+    by the time we ask for it.
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#include <zmq.h>
+#include "../include/zfl_prelude.h"
+#include "../include/zfl_pool.h"
+#include "../include/zfl_blob.h"
+#include "../include/zfl_msg.h"
+#include "../include/zfl_blob_reader.h"
+
+#define DEFAULT_CHUNK   65536   //  Used if caller asks for zero chunk size
+#define READ_AHEAD      4       //  Chunks we ask the kernel to read ahead
+
+//  Structure of our class
+
+struct _zfl_blob_reader_t {
+    FILE
+        *file;                  //  Stream we read from, or NULL
+    int
+        fd;                     //  Or, file descriptor we read from
+    size_t
+        chunk_size;             //  Size of each chunk
+    byte
+        *buffer;                //  Holds current chunk, plus null byte
+    zfl_blob_t
+        *chunk;                 //  Current chunk, borrows buffer
+    int64_t
+        offset;                 //  Offset of next chunk in input
+    Bool
+        finished;               //  We've reached end of input
+    int
+        error;                  //  errno of failed read, or zero
+};
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Ask the kernel to read the next few chunks ahead of us. This is only a
+//  hint; it fails harmlessly on pipes, and does nothing where the system
+//  doesn't support it.
+
+static void
+s_read_ahead (zfl_blob_reader_t *self)
+{
+#if defined (__UNIX__) && defined (POSIX_FADV_WILLNEED)
+    int fd = self->file? fileno (self->file): self->fd;
+    posix_fadvise (fd, (off_t) self->offset,
+                   (off_t) self->chunk_size * READ_AHEAD, POSIX_FADV_WILLNEED);
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Read the next chunk into the specified buffer, which must hold at least
+//  a chunk, until it's full or we reach the end of input. Returns the
+//  number of bytes read, which is zero at the end of input. If a read
+//  fails, records the error, drops the partial chunk, and returns zero.
+
+static size_t
+s_read_chunk (zfl_blob_reader_t *self, byte *buffer)
+{
+    if (self->finished)
+        return 0;
+
+    size_t size = 0;
+    while (size < self->chunk_size) {
+        if (self->file) {
+            errno = 0;
+            size_t rc = fread (buffer + size, 1,
+                               self->chunk_size - size, self->file);
+            size += rc;
+            if (rc == 0) {
+                if (ferror (self->file))
+                    self->error = errno? errno: EIO;
+                break;
+            }
+        }
+        else {
+#if defined (__WINDOWS__)
+            int rc = _read (self->fd, buffer + size,
+                            (unsigned int) (self->chunk_size - size));
+#else
+            ssize_t rc = read (self->fd, buffer + size,
+                               self->chunk_size - size);
+#endif
+            if (rc == -1 && errno == EINTR)
+                continue;
+            if (rc == -1)
+                self->error = errno;
+            if (rc <= 0)
+                break;
+            size += rc;
+        }
+    }
+    if (self->error) {
+        self->finished = TRUE;
+        return 0;
+    }
+    if (size < self->chunk_size)
+        self->finished = TRUE;
+    if (size) {
+        self->offset += size;
+        s_read_ahead (self);
+    }
+    return size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+//  Creates a reader that reads from the current position of the file to
+//  its end, in chunks of the specified size. The reader does not close
+//  the file.
+
+zfl_blob_reader_t *
+zfl_blob_reader_new (FILE *file, size_t chunk_size)
+{
+    zfl_blob_reader_t
+        *self;
+
+    self = (zfl_blob_reader_t *) zmalloc (sizeof (zfl_blob_reader_t));
+    self->file = file;
+    self->fd = -1;
+    self->chunk_size = chunk_size? chunk_size: DEFAULT_CHUNK;
+    self->buffer = (byte *) malloc (self->chunk_size + 1);
+    assert (self->buffer);
+    self->chunk = zfl_blob_new (NULL, 0);
+
+    if (file) {
+        self->offset = ftell (file);
+        if (self->offset < 0)
+            self->offset = 0;
+#if defined (__UNIX__) && defined (POSIX_FADV_SEQUENTIAL)
+        posix_fadvise (fileno (file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        s_read_ahead (self);
+    }
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+//  Creates a reader that reads from a file descriptor, e.g. a pipe or
+//  socket, bypassing stdio buffering. The reader does not close the file
+//  descriptor.
+
+zfl_blob_reader_t *
+zfl_blob_reader_new_fd (int fd, size_t chunk_size)
+{
+    zfl_blob_reader_t
+        *self;
+
+    assert (fd >= 0);
+    self = zfl_blob_reader_new (NULL, chunk_size);
+    self->fd = fd;
+#if defined (__UNIX__)
+    off_t offset = lseek (fd, 0, SEEK_CUR);
+    self->offset = offset > 0? offset: 0;
+#   if defined (POSIX_FADV_SEQUENTIAL)
+    posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#   endif
+#endif
+    s_read_ahead (self);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+
+void
+zfl_blob_reader_destroy (zfl_blob_reader_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zfl_blob_reader_t *self = *self_p;
+        zfl_blob_destroy (&self->chunk);
+        free (self->buffer);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Reads the next chunk and returns it as a blob, or returns NULL at the
+//  end of input or if a read failed; use zfl_blob_reader_error to tell
+//  which. Every chunk but the last is exactly the chunk size. The
+//  blob belongs to the reader and is valid until the next call; to keep a
+//  chunk, take a zfl_blob_ref of it, which copies the data.
+
+zfl_blob_t *
+zfl_blob_reader_next (zfl_blob_reader_t *self)
+{
+    assert (self);
+    size_t size = s_read_chunk (self, self->buffer);
+    if (size == 0)
+        return NULL;
+
+    self->buffer [size] = 0;
+    zfl_blob_set_dptr (self->chunk, self->buffer, size);
+    return self->chunk;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Reads the next chunk and returns it as the body of a new message, or
+//  returns NULL at the end of input or if a read failed. The chunk is read straight into the
+//  message body, and sending the message hands the body to 0MQ, so the
+//  data is never copied. Push any address or header parts you need onto
+//  the message and send it; sending each chunk as its own message, rather
+//  than as parts of one huge message, lets the socket's high-water mark
+//  bound the memory used for streaming.
+
+zfl_msg_t *
+zfl_blob_reader_msg (zfl_blob_reader_t *self)
+{
+    assert (self);
+    if (self->finished)
+        return NULL;
+
+    zfl_msg_t *msg = zfl_msg_new ();
+    byte *body = zfl_msg_body_alloc (msg, self->chunk_size);
+    size_t size = s_read_chunk (self, body);
+    if (size == 0)
+        zfl_msg_destroy (&msg);
+    else
+    if (size < self->chunk_size)
+        zfl_msg_body_truncate (msg, size);
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Returns the errno value of the read that failed, or zero if there was
+//  no error. Once a read has failed, the reader returns no more chunks.
+//  Check this after reading returns NULL, so that you don't mistake a
+//  failed read for the end of input and use a truncated stream.
+
+int
+zfl_blob_reader_error (zfl_blob_reader_t *self)
+{
+    assert (self);
+    return self->error;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+#define TEST_FILE       "zfl_blob_reader_selftest.tmp"
+#define TEST_SIZE       1000003     //  Not a multiple of chunk size
+#define TEST_CHUNK      65536
+
+int
+zfl_blob_reader_test (Bool verbose)
+{
+    zfl_blob_reader_t
+        *reader;
+
+    printf (" * zfl_blob_reader: ");
+
+    //  Write a test file with a recognizable pattern
+    FILE *file = fopen (TEST_FILE, "w+b");
+    assert (file);
+    size_t offset;
+    for (offset = 0; offset < TEST_SIZE; offset++)
+        fputc ((int) (offset % 251), file);
+    rewind (file);
+
+    //  Read it back in chunks
+    reader = zfl_blob_reader_new (file, TEST_CHUNK);
+    assert (reader);
+    size_t chunks = 0;
+    offset = 0;
+    zfl_blob_t *chunk;
+    while ((chunk = zfl_blob_reader_next (reader))) {
+        byte *data = zfl_blob_data (chunk);
+        size_t size = zfl_blob_size (chunk);
+        assert (size == TEST_CHUNK || offset + size == TEST_SIZE);
+        size_t index;
+        for (index = 0; index < size; index++)
+            assert (data [index] == (offset + index) % 251);
+        offset += size;
+        chunks++;
+    }
+    assert (offset == TEST_SIZE);
+    assert (chunks == TEST_SIZE / TEST_CHUNK + 1);
+    assert (zfl_blob_reader_next (reader) == NULL);
+    assert (zfl_blob_reader_error (reader) == 0);
+    zfl_blob_reader_destroy (&reader);
+    assert (reader == NULL);
+
+    //  Read it again as messages, from a file descriptor
+    lseek (fileno (file), 0, SEEK_SET);
+    reader = zfl_blob_reader_new_fd (fileno (file), 0);
+    offset = 0;
+    zfl_msg_t *msg;
+    while ((msg = zfl_blob_reader_msg (reader))) {
+        assert (zfl_msg_parts (msg) == 1);
+        byte *data = (byte *) zfl_msg_body (msg);
+        size_t size = zfl_msg_body_size (msg);
+        assert (data [0] == offset % 251);
+        assert (data [size - 1] == (offset + size - 1) % 251);
+        assert (data [size] == 0);
+        offset += size;
+        zfl_msg_destroy (&msg);
+    }
+    assert (offset == TEST_SIZE);
+    assert (zfl_blob_reader_error (reader) == 0);
+    zfl_blob_reader_destroy (&reader);
+    fclose (file);
+    remove (TEST_FILE);
+
+#if defined (__UNIX__)
+    //  Read errors are reported, not taken for the end of input; the
+    //  write end of a pipe can't be read
+    int fds [2];
+    int rc = pipe (fds);
+    assert (rc == 0);
+    reader = zfl_blob_reader_new_fd (fds [1], 4096);
+    assert (zfl_blob_reader_msg (reader) == NULL);
+    assert (zfl_blob_reader_error (reader) == EBADF);
+    assert (zfl_blob_reader_next (reader) == NULL);
+    zfl_blob_reader_destroy (&reader);
+    file = fdopen (fds [1], "w");
+    assert (file);
+    reader = zfl_blob_reader_new (file, 4096);
+    assert (zfl_blob_reader_next (reader) == NULL);
+    assert (zfl_blob_reader_error (reader) != 0);
+    zfl_blob_reader_destroy (&reader);
+
+    //  Pipes deliver short reads, but chunks are still full size
+    byte block [1000];
+    memset (block, 'x', sizeof (block));
+    int block_nbr;
+    for (block_nbr = 0; block_nbr < 10; block_nbr++) {
+        ssize_t written = write (fds [1], block, sizeof (block));
+        assert (written == sizeof (block));
+    }
+    fclose (file);              //  Also closes fds [1]
+    reader = zfl_blob_reader_new_fd (fds [0], 4096);
+    chunk = zfl_blob_reader_next (reader);
+    assert (zfl_blob_size (chunk) == 4096);
+    zfl_blob_t *kept = zfl_blob_ref (chunk);
+    chunk = zfl_blob_reader_next (reader);
+    assert (zfl_blob_size (chunk) == 4096);
+    chunk = zfl_blob_reader_next (reader);
+    assert (zfl_blob_size (chunk) == 10000 - 8192);
+    assert (zfl_blob_reader_next (reader) == NULL);
+    assert (zfl_blob_reader_error (reader) == 0);
+    assert (zfl_blob_size (kept) == 4096);
+    assert (zfl_blob_data (kept) [4095] == 'x');
+    zfl_blob_destroy (&kept);
+    zfl_blob_reader_destroy (&reader);
+    close (fds [0]);
+#endif
+
+    printf ("OK\n");
+    return 0;
+}
@@ -0,0 +1,503 @@
+/*  =========================================================================
+    zfl_chash.c - concurrent hash table
+
+    Hash table that many threads can use at once. The table is split into
+    a power-of-two number of shards, each a zfl_hash with its own
+    reader/writer lock, and each key lives in exactly one shard. Lookups
+    take the lock shared and use zfl_hash_peek, which does not change the
+    table, so lookups never wait on each other, only on a writer working
+    on the same shard. With enough shards that is rare.
+
+    Lookups are not lock-free in the strict sense: zfl_hash frees and
+    moves items as it grows, so a reader that ignored writers could read
+    freed memory.
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#include "../include/zfl_prelude.h"
+#include "../include/zfl_pool.h"
+#include "../include/zfl_hash.h"
+#include "../include/zfl_thread.h"
+#include "../include/zfl_time.h"
+#include "../include/zfl_chash.h"
+
+#define DEFAULT_SHARDS  64      //  Used if caller asks for zero shards
+#define SHARD_SIZE      128     //  Shards don't share cache lines
+
+//  One shard of the table, padded so that threads working on neighbouring
+//  shards don't fight over the same cache line
+
+typedef union {
+    struct {
+#if defined (__UNIX__)
+        pthread_rwlock_t
+            lock;
+#elif defined (__WINDOWS__)
+        SRWLOCK
+            lock;
+#else
+#   error "Platform not supported by zfl_chash class"
+#endif
+        zfl_hash_t
+            *hash;              //  Items in this shard
+    } s;
+    byte
+        padding [SHARD_SIZE];
+} shard_t;
+
+//  Structure of our class
+
+struct _zfl_chash_t {
+    size_t
+        shards;                 //  Number of shards, power of two
+    shard_t
+        *shard;                 //  Array of shards
+};
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Lock and unlock a shard, either exclusively, to change it, or shared
+//  with other threads, to read it
+
+static inline void
+s_shard_lock (shard_t *shard)
+{
+#if defined (__UNIX__)
+    int rc = pthread_rwlock_wrlock (&shard->s.lock);
+    assert (rc == 0);
+#elif defined (__WINDOWS__)
+    AcquireSRWLockExclusive (&shard->s.lock);
+#endif
+}
+
+static inline void
+s_shard_unlock (shard_t *shard)
+{
+#if defined (__UNIX__)
+    int rc = pthread_rwlock_unlock (&shard->s.lock);
+    assert (rc == 0);
+#elif defined (__WINDOWS__)
+    ReleaseSRWLockExclusive (&shard->s.lock);
+#endif
+}
+
+static inline void
+s_shard_lock_shared (shard_t *shard)
+{
+#if defined (__UNIX__)
+    int rc = pthread_rwlock_rdlock (&shard->s.lock);
+    assert (rc == 0);
+#elif defined (__WINDOWS__)
+    AcquireSRWLockShared (&shard->s.lock);
+#endif
+}
+
+static inline void
+s_shard_unlock_shared (shard_t *shard)
+{
+#if defined (__UNIX__)
+    int rc = pthread_rwlock_unlock (&shard->s.lock);
+    assert (rc == 0);
+#elif defined (__WINDOWS__)
+    ReleaseSRWLockShared (&shard->s.lock);
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Return the shard that holds the specified key. We hash the key with the
+//  seed of the first shard's table, so that peers can't aim keys at one
+//  shard, and take the top bits of the hash, since each shard's table uses
+//  the bottom bits of its own hash. The seed never changes, so we don't
+//  need to lock the first shard to read it.
+
+static shard_t *
+s_shard_for (zfl_chash_t *self, char *key)
+{
+    qbyte key_hash = zfl_hash_key_hash (self->shard [0].s.hash,
+                                        (byte *) key, strlen (key));
+    return &self->shard [((uint64_t) key_hash * self->shards) >> 32];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+//  Rounds the number of shards up to a power of two. If you pass zero, uses
+//  a default suitable for a few dozen threads.
+
+zfl_chash_t *
+zfl_chash_new (size_t shards)
+{
+    zfl_chash_t
+        *self;
+
+    self = (zfl_chash_t *) zmalloc (sizeof (zfl_chash_t));
+    if (shards == 0)
+        shards = DEFAULT_SHARDS;
+    self->shards = 1;
+    while (self->shards < shards)
+        self->shards *= 2;
+
+    //  With glibc's default, a steady stream of readers can keep a writer
+    //  out of a shard forever, so we ask for writers to go first
+#if defined (__UNIX__)
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init (&attr);
+#   if defined (__GLIBC__)
+    pthread_rwlockattr_setkind_np (&attr,
+        PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#   endif
+#endif
+    self->shard = (shard_t *) zmalloc (sizeof (shard_t) * self->shards);
+    size_t shard_nbr;
+    for (shard_nbr = 0; shard_nbr < self->shards; shard_nbr++) {
+        shard_t *shard = &self->shard [shard_nbr];
+#if defined (__UNIX__)
+        int rc = pthread_rwlock_init (&shard->s.lock, &attr);
+        assert (rc == 0);
+#elif defined (__WINDOWS__)
+        InitializeSRWLock (&shard->s.lock);
+#endif
+        shard->s.hash = zfl_hash_new ();
+    }
+#if defined (__UNIX__)
+    pthread_rwlockattr_destroy (&attr);
+#endif
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+//  No other thread may be using the table at this stage.
+
+void
+zfl_chash_destroy (zfl_chash_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zfl_chash_t *self = *self_p;
+        size_t shard_nbr;
+        for (shard_nbr = 0; shard_nbr < self->shards; shard_nbr++) {
+            shard_t *shard = &self->shard [shard_nbr];
+            zfl_hash_destroy (&shard->s.hash);
+#if defined (__UNIX__)
+            pthread_rwlock_destroy (&shard->s.lock);
+#endif
+        }
+        free (self->shard);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Insert item into hash table with specified key and value
+//  If key is already present returns -1 and leaves existing item unchanged
+//  Returns 0 on success.
+
+int
+zfl_chash_insert (zfl_chash_t *self, char *key, void *value)
+{
+    assert (self);
+    assert (key);
+
+    shard_t *shard = s_shard_for (self, key);
+    s_shard_lock (shard);
+    int rc = zfl_hash_insert (shard->s.hash, key, value);
+    s_shard_unlock (shard);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove an item specified by key from the hash table. If there was no such
+//  item, this function does nothing.
+
+void
+zfl_chash_delete (zfl_chash_t *self, char *key)
+{
+    assert (self);
+    assert (key);
+
+    shard_t *shard = s_shard_for (self, key);
+    s_shard_lock (shard);
+    zfl_hash_delete (shard->s.hash, key);
+    s_shard_unlock (shard);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Look for item in hash table and return its value, or NULL. Lookups on
+//  the same shard run at the same time; they wait only for a thread that
+//  is changing that shard. The table does not protect the value itself;
+//  if other threads may delete the item and destroy its value, you must
+//  coordinate that yourself.
+
+void *
+zfl_chash_lookup (zfl_chash_t *self, char *key)
+{
+    assert (self);
+    assert (key);
+
+    shard_t *shard = s_shard_for (self, key);
+    s_shard_lock_shared (shard);
+    void *value = zfl_hash_peek (shard->s.hash, key);
+    s_shard_unlock_shared (shard);
+    return value;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set a free function for the specified hash table item. When the item is
+//  destroyed, the free function, if any, is called on that item value.
+//  Returns the item value, or NULL if there is no such item.
+
+void *
+zfl_chash_freefn (zfl_chash_t *self, char *key, zfl_chash_free_fn *free_fn)
+{
+    assert (self);
+    assert (key);
+
+    shard_t *shard = s_shard_for (self, key);
+    s_shard_lock (shard);
+    void *value = zfl_hash_freefn (shard->s.hash, key, free_fn);
+    s_shard_unlock (shard);
+    return value;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of items in hash table. If other threads are modifying
+//  the table, this is a snapshot that may be out of date at once.
+
+size_t
+zfl_chash_size (zfl_chash_t *self)
+{
+    assert (self);
+
+    size_t
+        size = 0,
+        shard_nbr;
+    for (shard_nbr = 0; shard_nbr < self->shards; shard_nbr++) {
+        shard_t *shard = &self->shard [shard_nbr];
+        s_shard_lock_shared (shard);
+        size += zfl_hash_size (shard->s.hash);
+        s_shard_unlock_shared (shard);
+    }
+    return size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Apply function to each item in the hash table, one shard at a time.
+//  Each shard is locked against writers while the callback runs on its
+//  items, so the callback must not call back into the table. Stops if
+//  callback function returns non-zero and returns final return code from
+//  callback function (zero = success).
+
+int
+zfl_chash_apply (zfl_chash_t *self, zfl_chash_apply_fn *callback, void *argument)
+{
+    assert (self);
+
+    int
+        rc = 0;
+    size_t
+        shard_nbr;
+    for (shard_nbr = 0; shard_nbr < self->shards && rc == 0; shard_nbr++) {
+        shard_t *shard = &self->shard [shard_nbr];
+        s_shard_lock_shared (shard);
+        rc = zfl_hash_apply (shard->s.hash, callback, argument);
+        s_shard_unlock_shared (shard);
+    }
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+#define TEST_KEYS       100000  //  Keys in table during benchmark
+#define TEST_LOOKUPS    1000000 //  Lookups per reader thread, if verbose
+#define TEST_QUICK      10000   //  Lookups per reader thread, otherwise
+
+//  Arguments for reader and writer test threads
+typedef struct {
+    zfl_chash_t
+        *chash;
+    char
+        (*keys) [34];
+    int
+        first,                  //  Where this thread starts in keys
+        lookups;                //  Number of lookups to do
+} test_args_t;
+
+//  Reader thread does lookups on keys that are always present
+static void *
+s_test_reader (void *args)
+{
+    test_args_t *test = (test_args_t *) args;
+    int iteration;
+    int key_nbr = test->first;
+    for (iteration = 0; iteration < test->lookups; iteration++) {
+        void *value = zfl_chash_lookup (test->chash, test->keys [key_nbr]);
+        assert (value == test->keys [key_nbr]);
+        key_nbr = (key_nbr + 7919) % TEST_KEYS;
+    }
+    return NULL;
+}
+
+//  Writer thread keeps inserting and deleting its own keys until the
+//  main thread inserts a "stop" key
+static void *
+s_test_writer (void *args)
+{
+    test_args_t *test = (test_args_t *) args;
+    char key [34];
+    int key_nbr = 0;
+    while (!zfl_chash_lookup (test->chash, "stop")) {
+        sprintf (key, "writer-%d", key_nbr % 1000);
+        if (key_nbr % 2000 < 1000) {
+            int rc = zfl_chash_insert (test->chash, key, test->keys [0]);
+            assert (rc == 0);
+        }
+        else
+            zfl_chash_delete (test->chash, key);
+        key_nbr++;
+    }
+    //  Leave no writer keys behind for the next run
+    for (key_nbr = 0; key_nbr < 1000; key_nbr++) {
+        sprintf (key, "writer-%d", key_nbr);
+        zfl_chash_delete (test->chash, key);
+    }
+    return NULL;
+}
+
+static int
+s_test_count (char *key, void *value, void *argument)
+{
+    (*(size_t *) argument)++;
+    return 0;
+}
+
+int
+zfl_chash_test (Bool verbose)
+{
+    zfl_chash_t
+        *chash;
+
+    printf (" * zfl_chash: ");
+    chash = zfl_chash_new (0);
+    assert (chash);
+    assert (zfl_chash_size (chash) == 0);
+
+    //  Basic single-threaded operations
+    int rc;
+    rc = zfl_chash_insert (chash, "DEADBEEF", (void *) 0xDEADBEEF);
+    assert (rc == 0);
+    rc = zfl_chash_insert (chash, "ABADCAFE", (void *) 0xABADCAFE);
+    assert (rc == 0);
+    rc = zfl_chash_insert (chash, "DEADBEEF", (void *) 0xF0000000);
+    assert (rc == -1);
+    assert (zfl_chash_lookup (chash, "DEADBEEF") == (void *) 0xDEADBEEF);
+    assert (zfl_chash_lookup (chash, "ABADCAFE") == (void *) 0xABADCAFE);
+    assert (zfl_chash_lookup (chash, "C0DEDBAD") == NULL);
+    rc = zfl_chash_insert (chash, "C0DEDBAD", strdup ("heap value"));
+    assert (rc == 0);
+    assert (zfl_chash_freefn (chash, "C0DEDBAD", free));
+    assert (zfl_chash_size (chash) == 3);
+    size_t count = 0;
+    zfl_chash_apply (chash, s_test_count, &count);
+    assert (count == 3);
+    zfl_chash_delete (chash, "DEADBEEF");
+    assert (zfl_chash_lookup (chash, "DEADBEEF") == NULL);
+    assert (zfl_chash_size (chash) == 2);
+    zfl_chash_destroy (&chash);
+    assert (chash == NULL);
+
+    //  Benchmark lookups from 1, 2, 4 and 8 threads while another thread
+    //  keeps inserting and deleting other keys. We only do a full run when
+    //  verbose, since that's when we report the results
+    int lookups = verbose? TEST_LOOKUPS: TEST_QUICK;
+    char
+        (*keys) [34] = (char (*) [34]) zmalloc (TEST_KEYS * 34);
+    chash = zfl_chash_new (0);
+    int key_nbr;
+    for (key_nbr = 0; key_nbr < TEST_KEYS; key_nbr++) {
+        sprintf (keys [key_nbr], "@%08X%08X%08X%08X",
+            rand (), rand (), rand (), key_nbr);
+        rc = zfl_chash_insert (chash, keys [key_nbr], keys [key_nbr]);
+        assert (rc == 0);
+    }
+    //  Keys spread evenly over the shards
+    size_t shard_nbr;
+    for (shard_nbr = 0; shard_nbr < chash->shards; shard_nbr++) {
+        size_t size = zfl_hash_size (chash->shard [shard_nbr].s.hash);
+        assert (size > TEST_KEYS / chash->shards / 2);
+        assert (size < TEST_KEYS / chash->shards * 2);
+    }
+    int threads;
+    for (threads = 1; threads <= 8; threads *= 2) {
+        test_args_t args [8 + 1];
+        zfl_thread_t *thread [8 + 1];
+
+        args [8].chash = chash;
+        args [8].keys = keys;
+        thread [8] = zfl_thread_new (s_test_writer, &args [8]);
+        assert (thread [8]);
+
+        int64_t start = zfl_time_now ();
+        int thread_nbr;
+        for (thread_nbr = 0; thread_nbr < threads; thread_nbr++) {
+            args [thread_nbr].chash = chash;
+            args [thread_nbr].keys = keys;
+            args [thread_nbr].first = thread_nbr * (TEST_KEYS / 8);
+            args [thread_nbr].lookups = lookups;
+            thread [thread_nbr] = zfl_thread_new (s_test_reader, &args [thread_nbr]);
+            assert (thread [thread_nbr]);
+        }
+        for (thread_nbr = 0; thread_nbr < threads; thread_nbr++) {
+            zfl_thread_wait (thread [thread_nbr]);
+            zfl_thread_destroy (&thread [thread_nbr]);
+        }
+        int64_t elapsed = zfl_time_now () - start;
+        zfl_chash_insert (chash, "stop", chash);
+        zfl_thread_wait (thread [8]);
+        zfl_thread_destroy (&thread [8]);
+        zfl_chash_delete (chash, "stop");
+
+        if (verbose)
+            printf ("%d thread(s) %d lookups/second, ", threads,
+                (int) ((double) lookups * threads * 1000000
+                     / (elapsed > 0? elapsed: 1)));
+    }
+    assert (zfl_chash_size (chash) == TEST_KEYS);
+    zfl_chash_destroy (&chash);
+    free (keys);
+
+    printf ("OK\n");
+    return 0;
+}
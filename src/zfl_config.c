@@ -127,22 +127,23 @@ zfl_config_load (char *filename)
         if (!file)
             return NULL;        //  File missing or not readable
     }
-    //  Load file data into a memory blob
+    //  Map file data into a memory blob
     zfl_blob_t *blob = zfl_blob_new (NULL, 0);
     assert (blob);
-    assert (zfl_blob_load (blob, file));
+    assert (zfl_blob_mmap (blob, file));
     fclose (file);
 
-    //  Autodetect whether it's JSON or ZPL text
-    char *data = (char *) zfl_blob_data (blob);
+    //  Autodetect whether it's JSON or ZPL text; the parsers work in place
+    char *text = (char *) zfl_blob_writable (blob);
+    char *data = text;
     while (isspace (*data))
         data++;
 
     zfl_config_t *self;
     if (*data == '{')
-        self = zfl_config_json ((char *) zfl_blob_data (blob));
+        self = zfl_config_json (text);
     else
-        self = zfl_config_zpl ((char *) zfl_blob_data (blob));
+        self = zfl_config_zpl (text);
 
     zfl_blob_destroy (&blob);
     return self;
@@ -319,7 +320,8 @@ zfl_config_value (zfl_config_t *self)
 
 
 //  --------------------------------------------------------------------------
-//  Set config value from specified blob. Note that the data is copied.
+//  Set config value from specified blob. The config shares the blob's
+//  data rather than copying it, unless the blob borrows its data.
 
 int
 zfl_config_set_value (zfl_config_t *self, zfl_blob_t *blob)
@@ -327,7 +329,7 @@ zfl_config_set_value (zfl_config_t *self, zfl_blob_t *blob)
     assert (self);
     zfl_blob_destroy (&self->blob);
     if (blob)
-        self->blob = zfl_blob_new (zfl_blob_data (blob), zfl_blob_size (blob));
+        self->blob = zfl_blob_ref (blob);
     return 0;
 }
 
@@ -368,16 +370,16 @@ zfl_config_set_string (zfl_config_t *self, char *string)
 int
 zfl_config_set_printf (zfl_config_t *self, char *format, ...)
 {
-    char value [255 + 1];
     va_list args;
 
     assert (self);
+    zfl_blob_t *blob = zfl_blob_new (NULL, 0);
     va_start (args, format);
-    vsnprintf (value, 255, format, args);
+    zfl_blob_append_vprintf (blob, format, args);
     va_end (args);
+    //  Count the null byte in the size, as zfl_config_set_string does
+    zfl_blob_append (blob, (byte *) "", 1);
 
-    zfl_blob_t *blob = zfl_blob_new (NULL, 0);
-    zfl_blob_set_dptr (blob, (byte *) value, strlen (value) + 1);
     zfl_config_set_value (self, blob);
     zfl_blob_destroy (&blob);
     return 0;
@@ -457,6 +459,13 @@ zfl_config_test (Bool verbose)
     zfl_config_set_string (swap, "25000000");
     subscribe = zfl_config_new ("subscribe", option);
     zfl_config_set_printf (subscribe, "#%d", 2);
+    assert (streq (zfl_config_string (subscribe), "#2"));
+    zfl_config_set_printf (subscribe, "%0300d", 2);
+    assert (strlen (zfl_config_string (subscribe)) == 300);
+    zfl_config_set_printf (subscribe, "#%d", 2);
+    assert (zfl_blob_size (zfl_config_value (subscribe)) == 3);
+    zfl_config_set_string (subscribe, "#2");
+    assert (zfl_blob_size (zfl_config_value (subscribe)) == 3);
     bind     = zfl_config_new ("bind", frontend);
     zfl_config_set_string (bind, "tcp://eth0:5555");
     backend  = zfl_config_new ("backend", root);
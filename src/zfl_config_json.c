@@ -152,9 +152,9 @@ zfl_config_json_file (char *filename)
     if (file) {
         zfl_blob_t *blob = zfl_blob_new (NULL, 0);
         assert (blob);
-        assert (zfl_blob_load (blob, file));
+        assert (zfl_blob_mmap (blob, file));
         fclose (file);
-        zfl_config_t *config = zfl_config_json ((char *) zfl_blob_data (blob));
+        zfl_config_t *config = zfl_config_json ((char *) zfl_blob_writable (blob));
         zfl_blob_destroy (&blob);
         return config;
     }
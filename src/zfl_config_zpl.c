@@ -78,7 +78,7 @@ s_collect_name (char **start, int lineno)
     char *name = (char *) zmalloc (length + 1);
     memcpy (name, readptr, length);
     name [length] = 0;
-    if (name [0]== '/' || name [length -1] == '/') {
+    if (length && (name [0]== '/' || name [length -1] == '/')) {
         fprintf (stderr, "E: (%d) '/' not valid at name start or end\n", lineno);
         zfree (name);
     }
@@ -174,7 +174,7 @@ s_process_line (zfl_config_t *root, char *start, int lineno)
 
     //  Strip whitespace off end of line
     int length = strlen (start);
-    while (isspace (start [length - 1]))
+    while (length && isspace (start [length - 1]))
         start [--length] = 0;
 
     //  Collect indentation level and name, if any
@@ -247,28 +247,28 @@ zfl_config_zpl (char *zpl_string)
     //  Prepare new zfl_config_t structure
     zfl_config_t *self = zfl_config_new ("root", NULL);
 
-    //  Process ZPL string line by line
-    char *next_line = zpl_string;
+    //  Process ZPL string line by line; we measure the string once, and
+    //  then find each end of line within the known length
+    zfl_blob_t *blob = zfl_blob_new (NULL, 0);
+    zfl_blob_set_dptr (blob, (byte *) zpl_string, strlen (zpl_string));
+    size_t offset = 0;
     int lineno = 0;
     Bool valid = TRUE;
-    while (*next_line) {
-        //  Find end of line, and trim spaces
-        char *eoln = strchr (next_line, '\n');
-        char *this_line = next_line;
+    while (offset < zfl_blob_size (blob)) {
+        char *this_line = zpl_string + offset;
+        char *eoln = (char *) zfl_blob_find (blob, offset, '\n');
         if (eoln) {
             //  Terminate string at end of line and move to next line
             *eoln = 0;
-            next_line = eoln + 1;
-        }
-        else {
-            //  Find end of line and set up end of loop
-            eoln = strchr (next_line, 0);
-            assert (eoln);
-            next_line = eoln;
+            offset = eoln - zpl_string + 1;
         }
+        else
+            offset = zfl_blob_size (blob);
+
         if (s_process_line (self, this_line, ++lineno))
             valid = FALSE;
     }
+    zfl_blob_destroy (&blob);
     //  Either the whole ZPL file is valid or none of it is
     if (!valid) {
         zfl_config_destroy (&self);
@@ -289,9 +289,9 @@ zfl_config_zpl_file (char *filename)
     if (file) {
         zfl_blob_t *blob = zfl_blob_new (NULL, 0);
         assert (blob);
-        assert (zfl_blob_load (blob, file));
+        assert (zfl_blob_mmap (blob, file));
         fclose (file);
-        zfl_config_t *config = zfl_config_zpl ((char *) zfl_blob_data (blob));
+        zfl_config_t *config = zfl_config_zpl ((char *) zfl_blob_writable (blob));
         zfl_blob_destroy (&blob);
         return config;
     }
@@ -316,6 +316,12 @@ zfl_config_zpl_test (Bool verbose)
     }
     zfl_config_destroy (&config);
 
+    //  Blank lines, including at the start and end, are valid
+    char zpl [] = "\n#   Comment\nmain\n\n    type = queue\n";
+    config = zfl_config_zpl (zpl);
+    assert (streq (zfl_config_resolve (config, "main/type", ""), "queue"));
+    zfl_config_destroy (&config);
+
     printf ("OK\n");
     return 0;
 }
@@ -1,7 +1,8 @@
 /*  =========================================================================
-    zfl_list.h - singly-linked list container
+    zfl_list.h - doubly-linked list container
 
-    Singly-linked list container.
+    Doubly-linked list container. Append and push return a handle to the
+    new node, which lets you remove or move that node without searching.
 
     -------------------------------------------------------------------------
     Copyright (c) 1991-2010 iMatix Corporation <www.imatix.com>
@@ -25,27 +26,138 @@
 */
 
 #include "../include/zfl_prelude.h"
+#include "../include/zfl_pool.h"
 #include "../include/zfl_list.h"
 
-//  List node, used internally only
+#define DEFAULT_FREELIST    16  //  Spare nodes each list keeps, by default
 
-struct node_t {
-    struct node_t
-        *next;
+//  List node; callers see it only as an opaque handle
+
+typedef struct _zfl_list_handle node_t;
+struct _zfl_list_handle {
+    node_t
+        *next,
+        *prev;
     void
         *value;
+    size_t
+        pass;                   //  Iteration that last visited the node
 };
 
 //  Actual list object
 
 struct _zfl_list {
-    struct node_t
+    node_t
         *head, *tail;
+    Bool
+        iterating;              //  Between first and the end of the list
+    node_t
+        *cursor,                //  Current node, or NULL if removed
+        *position;              //  Walk continues after this node, or
+                                //  from the head if NULL
     size_t
+        pass,                   //  Counts iterations, to mark visits
         size;
+    zfl_pool_t
+        *pool;                  //  Pool for nodes, if any
+    node_t
+        *freelist;              //  Spare nodes, linked by next
+    size_t
+        free_size,              //  Number of spare nodes
+        free_max,               //  Most spare nodes we keep
+        allocs;                 //  Nodes taken from pool or heap
 };
 
 
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Take node off the list, and put it back at the tail
+
+static void
+s_node_unlink (zfl_list_t *self, node_t *node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        self->head = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        self->tail = node->prev;
+}
+
+static void
+s_node_link_tail (zfl_list_t *self, node_t *node)
+{
+    node->next = NULL;
+    node->prev = self->tail;
+    if (self->tail)
+        self->tail->next = node;
+    else
+        self->head = node;
+    self->tail = node;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Get a node from the freelist, or the pool; and put it back on the
+//  freelist, if that's not full already
+
+static node_t *
+s_node_new (zfl_list_t *self, void *value)
+{
+    node_t *node = self->freelist;
+    if (node) {
+        self->freelist = node->next;
+        self->free_size--;
+    }
+    else {
+        node = (node_t *) zfl_pool_alloc (self->pool, sizeof (node_t));
+        self->allocs++;
+    }
+    node->value = value;
+    node->pass = 0;
+    return node;
+}
+
+static void
+s_node_free (zfl_list_t *self, node_t *node)
+{
+    if (self->free_size < self->free_max) {
+        node->next = self->freelist;
+        self->freelist = node;
+        self->free_size++;
+    }
+    else
+        zfl_pool_free (self->pool, node);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Move the cursor to the next node this iteration has not yet visited, and
+//  return its value. Nodes moved to the tail after we visited them are
+//  skipped. Returns NULL and ends the iteration at the end of the list.
+
+static void *
+s_cursor_advance (zfl_list_t *self)
+{
+    node_t *node = self->position? self->position->next: self->head;
+    while (node && node->pass == self->pass)
+        node = node->next;
+
+    self->cursor = node;
+    self->position = node;
+    if (node == NULL) {
+        self->iterating = FALSE;
+        return NULL;
+    }
+    node->pass = self->pass;
+    return node->value;
+}
+
+
 //  --------------------------------------------------------------------------
 //  List constructor
 
@@ -53,6 +165,20 @@ zfl_list_t *
 zfl_list_new (void)
 {
     zfl_list_t *self = (zfl_list_t *) zmalloc (sizeof (zfl_list_t));
+    self->free_max = DEFAULT_FREELIST;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  List constructor, taking list nodes from the specified pool rather than
+//  the heap. The pool must outlive the list.
+
+zfl_list_t *
+zfl_list_new_pool (zfl_pool_t *pool)
+{
+    zfl_list_t *self = zfl_list_new ();
+    self->pool = pool;
     return self;
 }
 
@@ -66,11 +192,12 @@ zfl_list_destroy (zfl_list_t **self_p)
     assert (self_p);
     if (*self_p) {
         zfl_list_t *self = *self_p;
-        struct node_t *node, *next;
+        node_t *node, *next;
         for (node = (*self_p)->head; node != NULL; node = next) {
             next = node->next;
-            free (node);
+            zfl_pool_free (self->pool, node);
         }
+        zfl_list_set_freelist (self, 0);
         free (self);
         *self_p = NULL;
     }
@@ -79,85 +206,211 @@ zfl_list_destroy (zfl_list_t **self_p)
 
 //  --------------------------------------------------------------------------
 //  Return the value at the head of list. If the list is empty, returns NULL.
-//  Note that this function does not remove the value from the list.
+//  Note that this function does not remove the value from the list. Also
+//  starts an iteration; use zfl_list_next to get the following values.
 
 void *
 zfl_list_first (zfl_list_t *self)
 {
     assert (self);
-    if (self->head)
-        return self->head->value;
-    else
+    self->iterating = TRUE;
+    self->position = NULL;
+    self->pass++;
+    return s_cursor_advance (self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the next value in the list, or NULL at the end of the list. Once
+//  the iteration has ended, keeps returning NULL until you call
+//  zfl_list_first again. While iterating you can remove any node, including
+//  the current one. Each node is visited at most once: a node you move to
+//  the tail is visited there if the walk had not reached it yet, and is not
+//  visited again if it had. Nodes added after the current node are visited.
+
+void *
+zfl_list_next (zfl_list_t *self)
+{
+    assert (self);
+    if (!self->iterating)
         return NULL;
+    return s_cursor_advance (self);
 }
 
 
 //  --------------------------------------------------------------------------
-//  Add value to the end of the list
+//  Return a handle to the node holding the value that zfl_list_first or
+//  zfl_list_next last returned, or NULL if there is none, either because
+//  the iteration has ended or because that node has been removed.
 
-void
+zfl_list_handle_t *
+zfl_list_cursor (zfl_list_t *self)
+{
+    assert (self);
+    return self->cursor;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add value to the end of the list. Returns a handle to the new node,
+//  which you can pass to zfl_list_remove_handle and zfl_list_move_tail.
+//  The handle is valid until its node leaves the list.
+
+zfl_list_handle_t *
 zfl_list_append (zfl_list_t *self, void *value)
 {
-    struct node_t *node;
-    node = (struct node_t *) zmalloc (sizeof (struct node_t));
-    node->value = value;
-    if (self->tail)
-        self->tail->next = node;
-    else
-        self->head = node;
-    self->tail = node;
-    node->next = NULL;
+    node_t *node = s_node_new (self, value);
+    s_node_link_tail (self, node);
     self->size++;
+    return node;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Insert value at the beginning of the list
+//  Insert value at the beginning of the list. Returns a handle to the new
+//  node, as for zfl_list_append.
 
-void
+zfl_list_handle_t *
 zfl_list_push (zfl_list_t *self, void *value)
 {
-    struct node_t *node;
-    node = (struct node_t *) zmalloc (sizeof (struct node_t));
-    node->value = value;
+    node_t *node = s_node_new (self, value);
+    node->prev = NULL;
     node->next = self->head;
+    if (self->head)
+        self->head->prev = node;
+    else
+        self->tail = node;
     self->head = node;
-    if (self->tail == NULL)
+    self->size++;
+    return node;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Insert value into a list kept in the order defined by the comparator,
+//  after any values that compare equal to it. Searches from the tail, so
+//  adding values in roughly ascending order, such as deadlines, takes
+//  constant time. Returns a handle to the new node, as for zfl_list_append.
+
+zfl_list_handle_t *
+zfl_list_insert_sorted (zfl_list_t *self, void *value,
+                        zfl_list_compare_fn *compare)
+{
+    assert (self);
+    assert (compare);
+
+    node_t *prev = self->tail;
+    while (prev && (compare) (prev->value, value) > 0)
+        prev = prev->prev;
+    if (prev == NULL)
+        return zfl_list_push (self, value);
+
+    node_t *node = s_node_new (self, value);
+    node->prev = prev;
+    node->next = prev->next;
+    if (prev->next)
+        prev->next->prev = node;
+    else
         self->tail = node;
+    prev->next = node;
     self->size++;
+    return node;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove and return the value at the head of the list, or NULL if the list
+//  is empty.
+
+void *
+zfl_list_pop (zfl_list_t *self)
+{
+    assert (self);
+    if (self->head == NULL)
+        return NULL;
+    void *value = self->head->value;
+    zfl_list_remove_handle (self, self->head);
+    return value;
 }
 
 
 //  --------------------------------------------------------------------------
 //  Remove the value value from the list. The value must be stored in the list.
 //  The function does not deallocate the memory pointed to by the removed value.
+//  This searches the list for the value; if you have a handle for the node,
+//  zfl_list_remove_handle is faster.
 
 void
 zfl_list_remove (zfl_list_t *self, void *value)
 {
-    struct node_t *node, *prev = NULL;
+    node_t *node;
 
     //  First off, we need to find the list node.
     for (node = self->head; node != NULL; node = node->next) {
         if (node->value == value)
             break;
-        prev = node;
     }
     assert (node);
+    zfl_list_remove_handle (self, node);
+}
 
-    if (prev)
-        prev->next = node->next;
-    else
-        self->head = node->next;
 
-    if (node->next == NULL)
-        self->tail = prev;
+//  --------------------------------------------------------------------------
+//  Remove the node with the specified handle from the list, in constant
+//  time. The handle is no longer valid afterwards.
 
-    free (node);
+void
+zfl_list_remove_handle (zfl_list_t *self, zfl_list_handle_t *handle)
+{
+    assert (self);
+    assert (handle);
+    if (self->cursor == handle)
+        self->cursor = NULL;
+    if (self->position == handle)
+        self->position = handle->prev;
+    s_node_unlink (self, handle);
+    s_node_free (self, handle);
     self->size--;
 }
 
 
+//  --------------------------------------------------------------------------
+//  Move the node with the specified handle to the end of the list, in
+//  constant time. The handle stays valid.
+
+void
+zfl_list_move_tail (zfl_list_t *self, zfl_list_handle_t *handle)
+{
+    assert (self);
+    assert (handle);
+    if (handle != self->tail) {
+        if (self->position == handle)
+            self->position = handle->prev;
+        s_node_unlink (self, handle);
+        s_node_link_tail (self, handle);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the number of removed nodes the list keeps for reuse, so that a list
+//  whose size stays roughly steady does not go to the pool or heap for
+//  each new node. Defaults to 16. Setting zero releases all spare nodes.
+
+void
+zfl_list_set_freelist (zfl_list_t *self, size_t max_nodes)
+{
+    assert (self);
+    self->free_max = max_nodes;
+    while (self->free_size > max_nodes) {
+        node_t *node = self->freelist;
+        self->freelist = node->next;
+        self->free_size--;
+        zfl_pool_free (self->pool, node);
+    }
+}
+
+
 //  --------------------------------------------------------------------------
 //  Make copy of itself
 
@@ -167,10 +420,10 @@ zfl_list_copy (zfl_list_t *self)
     if (!self)
         return NULL;
 
-    zfl_list_t *copy = zfl_list_new ();
+    zfl_list_t *copy = zfl_list_new_pool (self->pool);
     assert (copy);
 
-    struct node_t *node;
+    node_t *node;
     for (node = self->head; node; node = node->next)
         zfl_list_append (copy, node->value);
     return copy;
@@ -190,6 +443,12 @@ zfl_list_size (zfl_list_t *self)
 //  --------------------------------------------------------------------------
 //  Runs selftest of class
 
+static int
+s_test_compare (void *value1, void *value2)
+{
+    return *(int *) value1 - *(int *) value2;
+}
+
 void
 zfl_list_test (int verbose)
 {
@@ -246,7 +505,161 @@ zfl_list_test (int verbose)
     zfl_list_remove (list, wine);
     assert (zfl_list_size (list) == 0);
 
+    //  Handles let us move and remove nodes without searching
+    zfl_list_handle_t *cheese_handle = zfl_list_append (list, cheese);
+    zfl_list_handle_t *bread_handle = zfl_list_append (list, bread);
+    zfl_list_handle_t *wine_handle = zfl_list_push (list, wine);
+    assert (zfl_list_first (list) == wine);
+    zfl_list_move_tail (list, wine_handle);
+    assert (zfl_list_first (list) == cheese);
+    zfl_list_move_tail (list, cheese_handle);
+    assert (zfl_list_first (list) == bread);
+    zfl_list_move_tail (list, cheese_handle);
+    zfl_list_remove_handle (list, bread_handle);
+    assert (zfl_list_first (list) == wine);
+    assert (zfl_list_size (list) == 2);
+    zfl_list_remove_handle (list, cheese_handle);
+    zfl_list_remove (list, wine);
+    assert (zfl_list_size (list) == 0);
+    assert (zfl_list_first (list) == NULL);
+
+    //  Heartbeat many peers, moving each to the tail, as zfl_rpcd does;
+    //  with handles this takes the same time per heartbeat at any size
+    int
+        peers = 10000,
+        peer_nbr,
+        heartbeat;
+    zfl_list_handle_t
+        **handles = (zfl_list_handle_t **)
+            zmalloc (peers * sizeof (zfl_list_handle_t *));
+    for (peer_nbr = 0; peer_nbr < peers; peer_nbr++)
+        handles [peer_nbr] = zfl_list_append (list, &handles [peer_nbr]);
+    for (heartbeat = 0; heartbeat < 1000000; heartbeat++)
+        zfl_list_move_tail (list, handles [randof (peers)]);
+    assert (zfl_list_size (list) == (size_t) peers);
+
+    //  Requeue peers by remove and append, as LRU queues do; once the
+    //  freelist has a spare node this takes no further allocations
+    size_t allocs = list->allocs;
+    for (heartbeat = 0; heartbeat < 1000000; heartbeat++) {
+        peer_nbr = randof (peers);
+        zfl_list_remove_handle (list, handles [peer_nbr]);
+        handles [peer_nbr] = zfl_list_append (list, &handles [peer_nbr]);
+    }
+    assert (list->allocs == allocs);
+    for (peer_nbr = 0; peer_nbr < peers; peer_nbr++)
+        zfl_list_remove_handle (list, handles [peer_nbr]);
+    assert (zfl_list_size (list) == 0);
+    assert (list->free_size == DEFAULT_FREELIST);
+    free (handles);
+
+    //  Freelist limit is configurable
+    zfl_list_set_freelist (list, 2);
+    assert (list->free_size == 2);
+    allocs = list->allocs;
+    zfl_list_append (list, cheese);
+    zfl_list_append (list, bread);
+    zfl_list_append (list, wine);
+    assert (list->allocs == allocs + 1);
+    zfl_list_set_freelist (list, 0);
+    while (zfl_list_pop (list));
+    assert (list->free_size == 0);
+    assert (list->freelist == NULL);
+
+    //  Iterate without copying, removing values as we go
+    zfl_list_append (list, cheese);
+    zfl_list_append (list, bread);
+    zfl_list_append (list, wine);
+    assert (zfl_list_first (list) == cheese);
+    assert (zfl_list_next (list) == bread);
+    assert (zfl_list_next (list) == wine);
+    assert (zfl_list_next (list) == NULL);
+    assert (zfl_list_cursor (list) == NULL);
+    char *value;
+    for (value = (char *) zfl_list_first (list); value;
+         value = (char *) zfl_list_next (list))
+        if (value != bread)
+            zfl_list_remove_handle (list, zfl_list_cursor (list));
+    assert (zfl_list_size (list) == 1);
+    assert (zfl_list_pop (list) == bread);
+    assert (zfl_list_pop (list) == NULL);
+
+    //  Removing the current node clears the cursor, and the walk goes on
+    //  with the following node
+    zfl_list_append (list, cheese);
+    zfl_list_append (list, bread);
+    zfl_list_append (list, wine);
+    assert (zfl_list_first (list) == cheese);
+    assert (zfl_list_next (list) == bread);
+    zfl_list_remove_handle (list, zfl_list_cursor (list));
+    assert (zfl_list_cursor (list) == NULL);
+    assert (zfl_list_next (list) == wine);
+    assert (zfl_list_cursor (list) != NULL);
+
+    //  Once the walk has ended, next does not start it again
+    assert (zfl_list_next (list) == NULL);
+    assert (zfl_list_cursor (list) == NULL);
+    assert (zfl_list_next (list) == NULL);
+    zfl_list_remove (list, cheese);
+    zfl_list_remove (list, wine);
+    assert (zfl_list_next (list) == NULL);
+
+    //  Moving nodes to the tail, as LRU queues do, neither skips nodes nor
+    //  visits any node twice, even if we move every node we visit
+    zfl_list_append (list, cheese);
+    zfl_list_append (list, bread);
+    zfl_list_append (list, wine);
+    int visited = 0;
+    for (value = (char *) zfl_list_first (list); value;
+         value = (char *) zfl_list_next (list)) {
+        zfl_list_move_tail (list, zfl_list_cursor (list));
+        visited++;
+    }
+    assert (visited == 3);
+    assert (zfl_list_first (list) == cheese);
+    zfl_list_move_tail (list, zfl_list_cursor (list));
+    assert (zfl_list_next (list) == bread);
+    assert (zfl_list_next (list) == wine);
+    assert (zfl_list_next (list) == NULL);
+
+    //  A node moved to the tail before the walk reaches it comes last
+    assert (zfl_list_first (list) == bread);
+    zfl_list_move_tail (list, zfl_list_cursor (list)->next);
+    assert (zfl_list_next (list) == cheese);
+    assert (zfl_list_next (list) == wine);
+    assert (zfl_list_next (list) == NULL);
+    while (zfl_list_pop (list));
+
+    //  Sorted insert keeps equal values in arrival order
+    int deadlines [] = { 30, 10, 20, 40, 20, 5 };
+    int deadline_nbr;
+    for (deadline_nbr = 0; deadline_nbr < 6; deadline_nbr++)
+        zfl_list_insert_sorted (list, &deadlines [deadline_nbr], s_test_compare);
+    assert (zfl_list_pop (list) == &deadlines [5]);
+    assert (zfl_list_pop (list) == &deadlines [1]);
+    assert (zfl_list_pop (list) == &deadlines [2]);
+    assert (zfl_list_pop (list) == &deadlines [4]);
+    assert (zfl_list_pop (list) == &deadlines [0]);
+    assert (zfl_list_pop (list) == &deadlines [3]);
+    assert (zfl_list_size (list) == 0);
+
     zfl_list_destroy (&list);
     assert (list == NULL);
+
+    //  Same again with nodes from a pool
+    zfl_pool_t *pool = zfl_pool_new ();
+    list = zfl_list_new_pool (pool);
+    zfl_list_append (list, cheese);
+    zfl_list_push (list, bread);
+    zfl_list_append (list, wine);
+    assert (zfl_list_size (list) == 3);
+    zfl_list_t *copy = zfl_list_copy (list);
+    zfl_list_remove (list, cheese);
+    assert (zfl_list_first (list) == bread);
+    zfl_list_destroy (&list);
+    assert (zfl_list_size (copy) == 3);
+    zfl_list_destroy (&copy);
+    zfl_pool_destroy (&pool);
+
     printf ("OK\n");
 }
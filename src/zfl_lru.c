@@ -0,0 +1,450 @@
+/*  =========================================================================
+    zfl_lru.c - LRU cache
+
+    Cache that holds at most a given number of items, or of bytes, and
+    evicts the least recently used items to stay within those limits. A
+    zfl_hash maps keys to cache entries, and the entries sit on a doubly-
+    linked recency list, most recently used at the head, so that get, put,
+    touch and eviction all take constant time.
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#include "../include/zfl_prelude.h"
+#include "../include/zfl_pool.h"
+#include "../include/zfl_hash.h"
+#include "../include/zfl_lru.h"
+
+//  Cache entry, the hash table value for each key. The entry carries a copy
+//  of its key so that we can delete it from the hash table on eviction.
+
+typedef struct _entry_t entry_t;
+struct _entry_t {
+    entry_t
+        *prev,                  //  More recently used entry
+        *next;                  //  Less recently used entry
+    void
+        *value;                 //  Cached value
+    size_t
+        bytes;                  //  Size charged to the cache
+    char
+        key [];                 //  Item key, null-terminated
+};
+
+//  Structure of our class
+
+struct _zfl_lru_t {
+    zfl_hash_t
+        *hash;                  //  Maps keys to entries
+    entry_t
+        *head,                  //  Most recently used entry
+        *tail;                  //  Least recently used entry
+    zfl_hash_free_fn
+        *free_fn;               //  Called on values leaving the cache
+    size_t
+        max_items,              //  Item limit, or zero
+        max_bytes,              //  Byte limit, or zero
+        bytes,                  //  Bytes held now
+        hits,                   //  Number of gets that found their key
+        misses,                 //  Number of gets that did not
+        evictions;              //  Number of items evicted
+};
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Take entry off the recency list, and put it back at the head
+
+static void
+s_entry_unlink (zfl_lru_t *self, entry_t *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        self->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        self->tail = entry->prev;
+}
+
+static void
+s_entry_link (zfl_lru_t *self, entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = self->head;
+    if (self->head)
+        self->head->prev = entry;
+    else
+        self->tail = entry;
+    self->head = entry;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Remove entry from the cache and destroy it, passing its value to the
+//  free function, if any
+
+static void
+s_entry_destroy (zfl_lru_t *self, entry_t *entry)
+{
+    s_entry_unlink (self, entry);
+    zfl_hash_delete (self->hash, entry->key);
+    self->bytes -= entry->bytes;
+    if (self->free_fn)
+        (self->free_fn) (entry->value);
+    free (entry);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Evict least recently used entries until the cache is within its limits
+
+static void
+s_evict (zfl_lru_t *self)
+{
+    while (self->tail
+    && ((self->max_items && zfl_hash_size (self->hash) > self->max_items)
+    ||  (self->max_bytes && self->bytes > self->max_bytes))) {
+        s_entry_destroy (self, self->tail);
+        self->evictions++;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+//  Creates a cache that holds at most max_items items and max_bytes bytes,
+//  as counted by zfl_lru_put. A limit of zero means no limit.
+
+zfl_lru_t *
+zfl_lru_new (size_t max_items, size_t max_bytes)
+{
+    zfl_lru_t
+        *self;
+
+    self = (zfl_lru_t *) zmalloc (sizeof (zfl_lru_t));
+    self->hash = zfl_hash_new ();
+    self->max_items = max_items;
+    self->max_bytes = max_bytes;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+//  Passes all values still in the cache to the free function, if any.
+
+void
+zfl_lru_destroy (zfl_lru_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zfl_lru_t *self = *self_p;
+        while (self->head)
+            s_entry_destroy (self, self->head);
+        zfl_hash_destroy (&self->hash);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set a free function for values leaving the cache, whether evicted,
+//  replaced, deleted, or still cached when the cache is destroyed. You can
+//  pass 'free' or NULL as a free_fn.
+
+void
+zfl_lru_freefn (zfl_lru_t *self, zfl_hash_free_fn *free_fn)
+{
+    assert (self);
+    self->free_fn = free_fn;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Put value into cache with specified key, as most recently used item,
+//  replacing any value already cached with that key. Bytes is the size to
+//  charge against the byte limit. Evicts least recently used items as
+//  needed. The replaced value goes to the free function, unless it is the
+//  value being put. Returns 0 on success, or -1 if the value alone exceeds
+//  the byte limit, in which case the cache does not take the value.
+
+int
+zfl_lru_put (zfl_lru_t *self, char *key, void *value, size_t bytes)
+{
+    assert (self);
+    assert (key);
+    if (self->max_bytes && bytes > self->max_bytes)
+        return -1;
+
+    entry_t *entry = (entry_t *) zfl_hash_lookup (self->hash, key);
+    if (entry) {
+        //  Update entry in place; the old value leaves the cache unless
+        //  the caller is putting the same value again
+        if (self->free_fn && entry->value != value)
+            (self->free_fn) (entry->value);
+        entry->value = value;
+        self->bytes += bytes - entry->bytes;
+        entry->bytes = bytes;
+        if (entry != self->head) {
+            s_entry_unlink (self, entry);
+            s_entry_link (self, entry);
+        }
+        s_evict (self);
+        return 0;
+    }
+    size_t key_size = strlen (key);
+    entry = (entry_t *) malloc (sizeof (entry_t) + key_size + 1);
+    assert (entry);
+    memcpy (entry->key, key, key_size + 1);
+    entry->value = value;
+    entry->bytes = bytes;
+    int rc = zfl_hash_insert (self->hash, entry->key, entry);
+    assert (rc == 0);
+    s_entry_link (self, entry);
+    self->bytes += bytes;
+
+    s_evict (self);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return cached value for key, or NULL if it's not in the cache, and
+//  make the item the most recently used. Counts a hit or a miss.
+
+void *
+zfl_lru_get (zfl_lru_t *self, char *key)
+{
+    assert (self);
+    assert (key);
+
+    entry_t *entry = (entry_t *) zfl_hash_lookup (self->hash, key);
+    if (entry == NULL) {
+        self->misses++;
+        return NULL;
+    }
+    self->hits++;
+    if (entry != self->head) {
+        s_entry_unlink (self, entry);
+        s_entry_link (self, entry);
+    }
+    return entry->value;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Make the item the most recently used, without counting a hit. Returns
+//  0 on success, or -1 if the key is not in the cache.
+
+int
+zfl_lru_touch (zfl_lru_t *self, char *key)
+{
+    assert (self);
+    assert (key);
+
+    entry_t *entry = (entry_t *) zfl_hash_lookup (self->hash, key);
+    if (entry == NULL)
+        return -1;
+    if (entry != self->head) {
+        s_entry_unlink (self, entry);
+        s_entry_link (self, entry);
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove item from cache, passing its value to the free function, if any.
+//  If there was no such item, this function does nothing.
+
+void
+zfl_lru_delete (zfl_lru_t *self, char *key)
+{
+    assert (self);
+    assert (key);
+
+    entry_t *entry = (entry_t *) zfl_hash_lookup (self->hash, key);
+    if (entry)
+        s_entry_destroy (self, entry);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of items in cache
+
+size_t
+zfl_lru_size (zfl_lru_t *self)
+{
+    assert (self);
+    return zfl_hash_size (self->hash);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of bytes charged to cache
+
+size_t
+zfl_lru_bytes (zfl_lru_t *self)
+{
+    assert (self);
+    return self->bytes;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of gets that found their key, for monitoring
+
+size_t
+zfl_lru_hits (zfl_lru_t *self)
+{
+    assert (self);
+    return self->hits;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of gets that did not find their key, for monitoring
+
+size_t
+zfl_lru_misses (zfl_lru_t *self)
+{
+    assert (self);
+    return self->misses;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of items evicted to stay within limits, for monitoring
+
+size_t
+zfl_lru_evictions (zfl_lru_t *self)
+{
+    assert (self);
+    return self->evictions;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static int
+    s_test_freed;               //  Values passed to free function
+
+static void
+s_test_free (void *data)
+{
+    s_test_freed++;
+}
+
+int
+zfl_lru_test (Bool verbose)
+{
+    zfl_lru_t
+        *lru;
+
+    printf (" * zfl_lru: ");
+
+    //  Item limit
+    lru = zfl_lru_new (3, 0);
+    assert (lru);
+    zfl_lru_freefn (lru, s_test_free);
+    int rc;
+    rc = zfl_lru_put (lru, "cheese", "boursin", 7);
+    assert (rc == 0);
+    rc = zfl_lru_put (lru, "bread", "baguette", 8);
+    assert (rc == 0);
+    rc = zfl_lru_put (lru, "wine", "bordeaux", 8);
+    assert (rc == 0);
+    assert (zfl_lru_size (lru) == 3);
+    assert (zfl_lru_bytes (lru) == 23);
+
+    //  Using cheese leaves bread as the least recently used
+    assert (streq ((char *) zfl_lru_get (lru, "cheese"), "boursin"));
+    rc = zfl_lru_put (lru, "fruit", "apple", 5);
+    assert (rc == 0);
+    assert (zfl_lru_size (lru) == 3);
+    assert (zfl_lru_get (lru, "bread") == NULL);
+    assert (zfl_lru_evictions (lru) == 1);
+    assert (s_test_freed == 1);
+
+    //  Touching wine leaves cheese as the least recently used
+    rc = zfl_lru_touch (lru, "wine");
+    assert (rc == 0);
+    rc = zfl_lru_touch (lru, "bread");
+    assert (rc == -1);
+    rc = zfl_lru_put (lru, "bread", "brioche", 7);
+    assert (rc == 0);
+    assert (zfl_lru_get (lru, "cheese") == NULL);
+    assert (zfl_lru_get (lru, "wine"));
+    assert (zfl_lru_hits (lru) == 2);
+    assert (zfl_lru_misses (lru) == 2);
+
+    //  Putting an existing key replaces its value
+    rc = zfl_lru_put (lru, "bread", "baguette", 8);
+    assert (rc == 0);
+    assert (streq ((char *) zfl_lru_get (lru, "bread"), "baguette"));
+    assert (zfl_lru_size (lru) == 3);
+    assert (s_test_freed == 3);
+
+    //  Putting the same value again just refreshes it
+    rc = zfl_lru_put (lru, "bread", zfl_lru_get (lru, "bread"), 8);
+    assert (rc == 0);
+    assert (s_test_freed == 3);
+    assert (zfl_lru_size (lru) == 3);
+
+    zfl_lru_delete (lru, "bread");
+    assert (zfl_lru_size (lru) == 2);
+    assert (zfl_lru_bytes (lru) == 13);
+    zfl_lru_destroy (&lru);
+    assert (lru == NULL);
+    assert (s_test_freed == 6);
+
+    //  Byte limit
+    lru = zfl_lru_new (0, 100);
+    zfl_lru_freefn (lru, free);
+    char key [20];
+    int item_nbr;
+    for (item_nbr = 0; item_nbr < 100; item_nbr++) {
+        sprintf (key, "item-%d", item_nbr);
+        rc = zfl_lru_put (lru, key, strdup (key), 10);
+        assert (rc == 0);
+        assert (zfl_lru_bytes (lru) <= 100);
+    }
+    assert (zfl_lru_size (lru) == 10);
+    assert (zfl_lru_get (lru, "item-89") == NULL);
+    assert (streq ((char *) zfl_lru_get (lru, "item-90"), "item-90"));
+    char *value = (char *) zfl_lru_get (lru, "item-95");
+    rc = zfl_lru_put (lru, "item-95", value, 10);
+    assert (rc == 0);
+    assert (streq ((char *) zfl_lru_get (lru, "item-95"), "item-95"));
+    rc = zfl_lru_put (lru, "huge", NULL, 101);
+    assert (rc == -1);
+    assert (zfl_lru_size (lru) == 10);
+    zfl_lru_destroy (&lru);
+
+    printf ("OK\n");
+    return 0;
+}
@@ -29,123 +29,441 @@
 
 #include <zmq.h>
 #include "../include/zfl_prelude.h"
+#include "../include/zfl_pool.h"
+#include "../include/zfl_blob.h"
+#include "../include/zfl_time.h"
 #include "../include/zfl_msg.h"
 
-//  Pretty arbitrary limit on complexity of a message
-#define ZFL_MSG_MAX_PARTS  255
+//  Parts held inline in the message; messages with more parts keep them
+//  in a heap array that grows geometrically
+#define PARTS_INLINE        4
+
+//  Received parts at least this large are kept in their 0MQ message rather
+//  than copied; smaller ones are cheaper to copy than to track
+#define ZFL_MSG_ZERO_COPY   64
+
+//  Destroyed messages each thread keeps for reuse
+#define CACHE_MAX           64
+
+//  A single message part
+
+typedef struct {
+    byte
+        *data;                  //  Part data
+    size_t
+        size;                   //  Size of part data
+    zmq_msg_t
+        *message;               //  0MQ message holding data, if the part
+                                //  was received and has not been accessed
+                                //  as a string since
+    Bool
+        identity;               //  Part is a 0MQ identity
+} part_t;
 
 //  Structure of our class
-//  We access these properties only via class methods
+//  We access these properties only via class methods. The parts are a
+//  deque in _part_table, starting at _part_head, so that we can push and
+//  pop parts at the front without moving the others.
 
 struct _zfl_msg_t {
-    //  Part data follows message recv/send order
-    byte  *_part_data [ZFL_MSG_MAX_PARTS];
-    size_t _part_size [ZFL_MSG_MAX_PARTS];
-    size_t _part_count;
+    part_t *_part_table;        //  Part storage, inline or on heap
+    size_t _part_limit;         //  Number of slots in part storage
+    size_t _part_head;          //  Slot of first part
+    size_t _part_count;         //  Number of parts
+    zfl_pool_t *_pool;          //  Pool for part data, if any
+    Bool _binary_ids;           //  Leave identities as binary data?
+    zfl_msg_t *_next;           //  Next message in thread's cache
+    part_t _part_inline [PARTS_INLINE];
 };
 
+//  Each thread keeps a cache of destroyed messages, so that creating and
+//  destroying messages in a loop does not touch the heap
+
+typedef struct {
+    zfl_msg_t
+        *head;                  //  First cached message
+    size_t
+        size;                   //  Number of cached messages
+} cache_t;
+
+//  Part number n of message, counting from the front
+#define s_part(self,n)      (&(self)->_part_table [(self)->_part_head + (n)])
+
 
 //  --------------------------------------------------------------------------
-//  Constructor
+//  Private helper function to make room for one more part at the front or
+//  back of the message. We grow the part storage once it's half full, or
+//  for inline storage once it's full, and otherwise move the parts so the
+//  free slots are split between front and back.
 
-zfl_msg_t *
-zfl_msg_new (void)
+static void
+s_make_room (zfl_msg_t *self, Bool at_front)
 {
-    zfl_msg_t
-        *self;
-
-    self = (zfl_msg_t *) zmalloc (sizeof (zfl_msg_t));
-    return self;
+    if (at_front? self->_part_head > 0
+                : self->_part_head + self->_part_count < self->_part_limit)
+        return;
+
+    size_t limit = self->_part_limit;
+    if (self->_part_count == limit
+    || (self->_part_table != self->_part_inline
+        && self->_part_count * 2 >= limit))
+        limit *= 2;
+
+    size_t head = (limit - self->_part_count + (at_front? 1: 0)) / 2;
+    if (limit == self->_part_limit)
+        memmove (&self->_part_table [head], s_part (self, 0),
+            self->_part_count * sizeof (part_t));
+    else {
+        part_t *table = (part_t *) malloc (limit * sizeof (part_t));
+        assert (table);
+        memcpy (&table [head], s_part (self, 0),
+            self->_part_count * sizeof (part_t));
+        if (self->_part_table != self->_part_inline)
+            free (self->_part_table);
+        self->_part_table = table;
+        self->_part_limit = limit;
+    }
+    self->_part_head = head;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Destructor
+//  Private helper functions to add an empty part at the back or the front
+//  of the message, and return it
 
-void
-zfl_msg_destroy (zfl_msg_t **self_p)
+static part_t *
+s_append_part (zfl_msg_t *self)
 {
-    assert (self_p);
-    if (*self_p) {
-        zfl_msg_t *self = *self_p;
+    s_make_room (self, FALSE);
+    part_t *part = s_part (self, self->_part_count++);
+    part->message = NULL;
+    part->identity = FALSE;
+    return part;
+}
 
-        //  Free message parts, if any
-        while (self->_part_count)
-            free (zfl_msg_pop (self));
+static part_t *
+s_prepend_part (zfl_msg_t *self)
+{
+    s_make_room (self, TRUE);
+    self->_part_head--;
+    self->_part_count++;
+    part_t *part = s_part (self, 0);
+    part->message = NULL;
+    part->identity = FALSE;
+    return part;
+}
 
-        //  Free object structure
-        free (self);
-        *self_p = NULL;
+
+//  --------------------------------------------------------------------------
+//  Private helper function to free a single message part
+
+static void
+s_release_part (zfl_msg_t *self, part_t *part)
+{
+    if (part->message) {
+        zmq_msg_close (part->message);
+        free (part->message);
+        part->message = NULL;
     }
+    else
+        zfl_pool_free (self->_pool, part->data);
+    part->data = NULL;
+    part->identity = FALSE;
 }
 
 
 //  --------------------------------------------------------------------------
 //  Formats 17-byte UUID as 33-char string starting with '@'
-//  Lets us print UUIDs as C strings and use them as addresses
+//  Lets us print UUIDs as C strings and use them as addresses. The
+//  caller provides a buffer of at least 34 bytes.
 
-static char *
-s_encode_uuid (byte *data)
+static void
+s_encode_uuid (byte *data, char *uuidstr)
 {
-    static char
-        hex_char [] = "0123456789ABCDEF";
+    //  Two hex digits for each byte value
+    static const char
+        hex_pairs [] =
+        "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+        "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+        "404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+        "606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+        "808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+        "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+        "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+        "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
 
     assert (data [0] == 0);
-    char *uuidstr = (char *) zmalloc (34);
     uuidstr [0] = '@';
     int byte_nbr;
-    for (byte_nbr = 0; byte_nbr < 16; byte_nbr++) {
-        uuidstr [byte_nbr * 2 + 1] = hex_char [data [byte_nbr + 1] >> 4];
-        uuidstr [byte_nbr * 2 + 2] = hex_char [data [byte_nbr + 1] & 15];
-    }
+    for (byte_nbr = 0; byte_nbr < 16; byte_nbr++)
+        memcpy (uuidstr + byte_nbr * 2 + 1,
+            hex_pairs + data [byte_nbr + 1] * 2, 2);
     uuidstr [33] = 0;
-    return uuidstr;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Formats 17-byte UUID as 33-char string starting with '@'
-//  Lets us print UUIDs as C strings and use them as addresses
-
-static byte *
-s_decode_uuid (char *uuidstr)
-{
-    static char
-        hex_to_bin [128] = {
-           -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,    /*            */
-           -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,    /*            */
-           -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,    /*            */
-            0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,    /*   0..9     */
-           -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,    /*   A..F     */
-           -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,    /*            */
-           -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,    /*   a..f     */
-           -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1 };  /*            */
-
-    assert (strlen (uuidstr) == 33);
+//  Converts 33-char string starting with '@' back into 17-byte UUID
+//  The caller provides a buffer of at least 17 bytes.
+
+static void
+s_decode_uuid (char *uuidstr, byte *data)
+{
+    static const signed char
+        hex_to_bin [256] = {
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+         0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,
+        -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1 };
+
     assert (uuidstr [0] == '@');
-    byte *data = (byte *) zmalloc (17);
-    int byte_nbr;
     data [0] = 0;
+    int byte_nbr;
     for (byte_nbr = 0; byte_nbr < 16; byte_nbr++)
         data [byte_nbr + 1]
-            = (hex_to_bin [uuidstr [byte_nbr * 2 + 1] & 127] << 4)
-            + (hex_to_bin [uuidstr [byte_nbr * 2 + 2] & 127]);
+            = (hex_to_bin [(byte) uuidstr [byte_nbr * 2 + 1]] << 4)
+            + (hex_to_bin [(byte) uuidstr [byte_nbr * 2 + 2]]);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Private helper function to return a part as a C string. Part data held
+//  in a 0MQ message is not null-terminated, so we copy it out first.
+//  Identities become printable strings here, unless the message is in
+//  binary identity mode.
+
+static char *
+s_part_string (zfl_msg_t *self, part_t *part)
+{
+    if (part->identity && part->size == 17 && !self->_binary_ids) {
+        //  Format binary identity as printable string
+        char *uuidstr = (char *) zfl_pool_alloc (self->_pool, 34);
+        s_encode_uuid (part->data, uuidstr);
+        zfl_pool_free (self->_pool, part->data);
+        part->data = (byte *) uuidstr;
+        part->size = 33;
+    }
+    else
+    if (part->message) {
+        byte *data = (byte *) zfl_pool_alloc (self->_pool, part->size + 1);
+        memcpy (data, zmq_msg_data (part->message), part->size);
+        data [part->size] = 0;
+        zmq_msg_close (part->message);
+        free (part->message);
+        part->message = NULL;
+        part->data = data;
+    }
+    return (char *) part->data;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Private helper functions to get the calling thread's message cache.
+//  The cache is freed when the thread exits.
+
+static void
+s_cache_free (void *arg)
+{
+    cache_t *cache = (cache_t *) arg;
+    while (cache->head) {
+        zfl_msg_t *self = cache->head;
+        cache->head = self->_next;
+        free (self);
+    }
+    free (cache);
+}
+
+#if defined (__UNIX__)
+static pthread_key_t
+    s_cache_key;
+static pthread_once_t
+    s_cache_once = PTHREAD_ONCE_INIT;
+
+static void
+s_cache_init (void)
+{
+    int rc = pthread_key_create (&s_cache_key, s_cache_free);
+    assert (rc == 0);
+}
+
+static cache_t *
+s_cache (void)
+{
+    pthread_once (&s_cache_once, s_cache_init);
+    cache_t *cache = (cache_t *) pthread_getspecific (s_cache_key);
+    if (cache == NULL) {
+        cache = (cache_t *) zmalloc (sizeof (cache_t));
+        int rc = pthread_setspecific (s_cache_key, cache);
+        assert (rc == 0);
+    }
+    return cache;
+}
+#elif defined (__WINDOWS__)
+static DWORD
+    s_cache_key;
+static INIT_ONCE
+    s_cache_once = INIT_ONCE_STATIC_INIT;
+
+static VOID WINAPI
+s_cache_free_fls (PVOID arg)
+{
+    if (arg)
+        s_cache_free (arg);
+}
+
+static BOOL CALLBACK
+s_cache_init (PINIT_ONCE once, PVOID param, PVOID *context)
+{
+    s_cache_key = FlsAlloc (s_cache_free_fls);
+    assert (s_cache_key != FLS_OUT_OF_INDEXES);
+    return TRUE;
+}
 
-    return data;
+static cache_t *
+s_cache (void)
+{
+    InitOnceExecuteOnce (&s_cache_once, s_cache_init, NULL, NULL);
+    cache_t *cache = (cache_t *) FlsGetValue (s_cache_key);
+    if (cache == NULL) {
+        cache = (cache_t *) zmalloc (sizeof (cache_t));
+        FlsSetValue (s_cache_key, cache);
+    }
+    return cache;
 }
+#else
+#   error "Platform not supported by zfl_msg class"
+#endif
 
 
 //  --------------------------------------------------------------------------
-//  Private helper function to store a single message part
+//  Constructor
+//  Reuses a message from the thread's cache if there is one.
+
+zfl_msg_t *
+zfl_msg_new (void)
+{
+    zfl_msg_t
+        *self;
+
+    cache_t *cache = s_cache ();
+    if (cache->head) {
+        self = cache->head;
+        cache->head = self->_next;
+        cache->size--;
+    }
+    else {
+        self = (zfl_msg_t *) malloc (sizeof (zfl_msg_t));
+        assert (self);
+    }
+    self->_part_table = self->_part_inline;
+    self->_part_limit = PARTS_INLINE;
+    self->_part_head = 0;
+    self->_part_count = 0;
+    self->_pool = NULL;
+    self->_binary_ids = FALSE;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor, taking part data from the specified pool rather than the
+//  heap. The pool must outlive the message. Parts you pop or unwrap from
+//  the message also come from the pool; free them with zfl_pool_free.
+
+zfl_msg_t *
+zfl_msg_new_pool (zfl_pool_t *pool)
+{
+    zfl_msg_t
+        *self;
+
+    self = zfl_msg_new ();
+    self->_pool = pool;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Sets binary identity mode. By default, 0MQ identities are presented as
+//  33-char strings starting with '@', and such strings are sent back as
+//  identities. In binary mode, identities stay as the 17 bytes 0MQ uses,
+//  and parts are always sent as they are. Set the mode before receiving
+//  into the message; it stays set when you reset the message.
+
+void
+zfl_msg_set_binary_ids (zfl_msg_t *self, Bool binary)
+{
+    assert (self);
+    self->_binary_ids = binary;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+//  Keeps the message in the thread's cache for reuse, if there's room.
+
+void
+zfl_msg_destroy (zfl_msg_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zfl_msg_t *self = *self_p;
+        zfl_msg_reset (self);
+        if (self->_part_table != self->_part_inline)
+            free (self->_part_table);
+
+        cache_t *cache = s_cache ();
+        if (cache->size < CACHE_MAX) {
+            self->_next = cache->head;
+            cache->head = self;
+            cache->size++;
+        }
+        else
+            free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Empty message of all parts, so that you can reuse it. Keeps the part
+//  table, and the pool, if any.
+
+void
+zfl_msg_reset (zfl_msg_t *self)
+{
+    assert (self);
+    uint part_nbr;
+    for (part_nbr = 0; part_nbr < self->_part_count; part_nbr++)
+        s_release_part (self, s_part (self, part_nbr));
+    self->_part_head = 0;
+    self->_part_count = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Private helper function to store a copy of data in a message part
 
 static void
-s_set_part (zfl_msg_t *self, int part_nbr, byte *data, size_t size)
+s_set_part (zfl_msg_t *self, part_t *part, byte *data, size_t size)
 {
-    self->_part_size [part_nbr] = size;
-    self->_part_data [part_nbr] = (byte *) zmalloc (size + 1);
-    memcpy (self->_part_data [part_nbr], data, size);
+    part->size = size;
+    part->data = (byte *) zfl_pool_alloc (self->_pool, size + 1);
+    part->identity = FALSE;
+    memcpy (part->data, data, size);
     //  Convert to C string if needed
-    self->_part_data [part_nbr][size] = 0;
+    part->data [size] = 0;
 }
 
 
@@ -156,15 +474,27 @@ zfl_msg_t *
 zfl_msg_dup (zfl_msg_t *self)
 {
     assert (self);
-    zfl_msg_t *dup = zfl_msg_new ();
+    zfl_msg_t *dup = zfl_msg_new_pool (self->_pool);
     assert (dup);
+    dup->_binary_ids = self->_binary_ids;
 
+    //  Parts held in 0MQ messages are shared, not copied
     uint part_nbr;
-    for (part_nbr = 0; part_nbr < self->_part_count; part_nbr++)
-        s_set_part (dup, part_nbr,
-            self->_part_data [part_nbr], self->_part_size [part_nbr]);
-    dup->_part_count = self->_part_count;
-
+    for (part_nbr = 0; part_nbr < self->_part_count; part_nbr++) {
+        part_t *part = s_part (self, part_nbr);
+        part_t *copy = s_append_part (dup);
+        if (part->message) {
+            copy->message = (zmq_msg_t *) malloc (sizeof (zmq_msg_t));
+            assert (copy->message);
+            zmq_msg_init (copy->message);
+            zmq_msg_copy (copy->message, part->message);
+            copy->data = (byte *) zmq_msg_data (copy->message);
+            copy->size = part->size;
+        }
+        else
+            s_set_part (dup, copy, part->data, part->size);
+        copy->identity = part->identity;
+    }
     return dup;
 }
 
@@ -180,31 +510,52 @@ zfl_msg_recv (void *socket)
     assert (socket);
 
     zfl_msg_t *self = zfl_msg_new ();
-    while (1) {
-        assert (self->_part_count < ZFL_MSG_MAX_PARTS);
+    zfl_msg_recv_into (self, socket);
+    return self;
+}
 
-        zmq_msg_t message;
-        zmq_msg_init (&message);
-        if (zmq_recv (socket, &message, 0)) {
+
+//  --------------------------------------------------------------------------
+//  Receive message from socket into an existing message, replacing any
+//  parts it had. Blocks on recv if socket is not ready for input
+
+void
+zfl_msg_recv_into (zfl_msg_t *self, void *socket)
+{
+    assert (self);
+    assert (socket);
+
+    zfl_msg_reset (self);
+    zmq_msg_t *message = NULL;
+    while (1) {
+        if (!message) {
+            message = (zmq_msg_t *) malloc (sizeof (zmq_msg_t));
+            assert (message);
+        }
+        zmq_msg_init (message);
+        if (zmq_recv (socket, message, 0)) {
             if (errno != ETERM)
                 printf ("E: %s\n", zmq_strerror (errno));
             exit (1);
         }
-        //  We handle 0MQ UUIDs as printable strings
-        byte *data = (byte *) zmq_msg_data (&message);
-        size_t size = zmq_msg_size (&message);
-        if (size == 17 && data [0] == 0) {
-            //  Store message part as string uuid
-            char *uuidstr = s_encode_uuid (data);
-            self->_part_size [self->_part_count] = strlen (uuidstr);
-            self->_part_data [self->_part_count] = (byte *) uuidstr;
-            self->_part_count++;
+        //  We keep 0MQ UUIDs as binary data, flagged as identities, and
+        //  format them as strings only if they're accessed
+        byte *data = (byte *) zmq_msg_data (message);
+        size_t size = zmq_msg_size (message);
+        part_t *part = s_append_part (self);
+        if (size < ZFL_MSG_ZERO_COPY) {
+            //  Store copy of this message part
+            s_set_part (self, part, data, size);
+            part->identity = (size == 17 && data [0] == 0);
+            zmq_msg_close (message);
+        }
+        else {
+            //  Keep this message part in its 0MQ message
+            part->data = data;
+            part->size = size;
+            part->message = message;
+            message = NULL;
         }
-        else
-            //  Store this message part
-            s_set_part (self, self->_part_count++, data, size);
-
-        zmq_msg_close (&message);
 
         int64_t more;
         size_t more_size = sizeof (more);
@@ -212,7 +563,18 @@ zfl_msg_recv (void *socket)
         if (!more)
             break;      //  Last message part
     }
-    return self;
+    free (message);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Private helper function, called by 0MQ when it has finished with a
+//  part we handed over, possibly in one of its I/O threads
+
+static void
+s_free_part (void *data, void *hint)
+{
+    free (data);
 }
 
 
@@ -225,34 +587,58 @@ zfl_msg_send (zfl_msg_t **self_p, void *socket)
 {
     assert (self_p);
     assert (*self_p);
+    zfl_msg_send_keep (*self_p, socket);
+    zfl_msg_destroy (self_p);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send message to socket, and leave the message empty so that you can
+//  reuse it. Received parts go back to 0MQ as they are, and parts on the
+//  heap are handed over without copying; parts from a pool are copied,
+//  since 0MQ may release them in another thread and pools are not
+//  thread-safe.
+
+void
+zfl_msg_send_keep (zfl_msg_t *self, void *socket)
+{
+    assert (self);
     assert (socket);
-    zfl_msg_t *self = *self_p;
 
     uint part_nbr;
     for (part_nbr = 0; part_nbr < self->_part_count; part_nbr++) {
-        //  Could be improved to use zero-copy since we destroy
-        //  the message parts after sending anyhow...
         zmq_msg_t message;
 
         //  Unmangle 0MQ identities for writing to the socket
-        byte  *data = self->_part_data [part_nbr];
-        size_t size = self->_part_size [part_nbr];
-        if (size == 33 && data [0] == '@') {
-            byte *uuidbin = s_decode_uuid ((char *) data);
+        part_t *part = s_part (self, part_nbr);
+        if (part->message) {
+            //  Forward received part as it is
+            zmq_msg_init (&message);
+            zmq_msg_move (&message, part->message);
+        }
+        else
+        if (part->size == 33 && part->data [0] == '@'
+        && !self->_binary_ids) {
             zmq_msg_init_size (&message, 17);
-            memcpy (zmq_msg_data (&message), uuidbin, 17);
-            free (uuidbin);
+            s_decode_uuid ((char *) part->data,
+                (byte *) zmq_msg_data (&message));
+        }
+        else
+        if (self->_pool) {
+            zmq_msg_init_size (&message, part->size);
+            memcpy (zmq_msg_data (&message), part->data, part->size);
         }
         else {
-            zmq_msg_init_size (&message, size);
-            memcpy (zmq_msg_data (&message), data, size);
+            zmq_msg_init_data (&message, part->data, part->size,
+                s_free_part, NULL);
+            part->data = NULL;
         }
         int rc = zmq_send (socket, &message,
             part_nbr < self->_part_count - 1? ZMQ_SNDMORE: 0);
         assert (rc == 0);
         zmq_msg_close (&message);
     }
-    zfl_msg_destroy (self_p);
+    zfl_msg_reset (self);
 }
 
 
@@ -276,7 +662,7 @@ zfl_msg_body (zfl_msg_t *self)
     assert (self);
 
     if (self->_part_count)
-        return (char *) self->_part_data [self->_part_count - 1];
+        return s_part_string (self, s_part (self, self->_part_count - 1));
     else
         return NULL;
 }
@@ -291,7 +677,7 @@ zfl_msg_body_size (zfl_msg_t *self)
     assert (self);
 
     if (self->_part_count)
-        return self->_part_size [self->_part_count - 1];
+        return s_part (self, self->_part_count - 1)->size;
     else
         return 0;
 }
@@ -306,34 +692,98 @@ zfl_msg_body_set (zfl_msg_t *self, char *body)
 {
     assert (self);
     assert (body);
+    zfl_msg_body_set_data (self, (byte *) body, strlen (body));
+}
 
+
+//  --------------------------------------------------------------------------
+//  Set message body as copy of provided binary data
+//  If message is empty, creates a new message body
+
+void
+zfl_msg_body_set_data (zfl_msg_t *self, byte *data, size_t size)
+{
+    assert (self);
+    assert (data);
+
+    part_t *part;
+    if (self->_part_count) {
+        part = s_part (self, self->_part_count - 1);
+        s_release_part (self, part);
+    }
+    else
+        part = s_append_part (self);
+
+    s_set_part (self, part, data, size);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set message body to uninitialized data of the specified size, and
+//  return a pointer to it so that the caller can fill it in place, e.g.
+//  by reading into it. This avoids copying a large body that the caller
+//  would otherwise build in its own buffer. The pointer is valid until
+//  the body changes or the message is sent or destroyed.
+//  If message is empty, creates a new message body
+
+byte *
+zfl_msg_body_alloc (zfl_msg_t *self, size_t size)
+{
+    assert (self);
+
+    part_t *part;
     if (self->_part_count) {
-        assert (self->_part_data [self->_part_count - 1]);
-        free (self->_part_data [self->_part_count - 1]);
+        part = s_part (self, self->_part_count - 1);
+        s_release_part (self, part);
     }
     else
-        self->_part_count = 1;
+        part = s_append_part (self);
 
-    s_set_part (self, self->_part_count - 1, (byte *) body, strlen (body));
+    part->size = size;
+    part->data = (byte *) zfl_pool_alloc (self->_pool, size + 1);
+    part->identity = FALSE;
+    part->data [size] = 0;
+    return part->data;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Shorten the message body to the specified size, which must not be
+//  larger than its current size. Use after zfl_msg_body_alloc if you
+//  filled less of the body than you allocated.
+
+void
+zfl_msg_body_truncate (zfl_msg_t *self, size_t size)
+{
+    assert (self);
+    assert (self->_part_count);
+
+    part_t *part = s_part (self, self->_part_count - 1);
+    assert (size <= part->size);
+    if (part->message)
+        //  Received part; take a private copy before we change it
+        s_part_string (self, part);
+    part->size = size;
+    part->data [size] = 0;
 }
 
 
 //  --------------------------------------------------------------------------
 //  Set message body using printf format
 //  If message is empty, creates a new message body
-//  Hard-coded to max. 255 characters for this simplified class
 
 void
 zfl_msg_body_fmt (zfl_msg_t *self, char *format, ...)
 {
-    char value [255 + 1];
     va_list args;
 
     assert (self);
+    zfl_blob_t *value = zfl_blob_new (NULL, 0);
     va_start (args, format);
-    vsnprintf (value, sizeof (value), format, args);
+    zfl_blob_append_vprintf (value, format, args);
     va_end (args);
-    zfl_msg_body_set (self, value);
+    zfl_msg_body_set (self, (char *) zfl_blob_data (value));
+    zfl_blob_destroy (&value);
 }
 
 
@@ -345,21 +795,27 @@ zfl_msg_push (zfl_msg_t *self, char *part)
 {
     assert (self);
     assert (part);
-    assert (self->_part_count < ZFL_MSG_MAX_PARTS - 1);
+    s_set_part (self, s_prepend_part (self), (byte *) part, strlen (part));
+}
 
-    //  Move part stack up one element and insert new part
-    memmove (&self->_part_data [1], &self->_part_data [0],
-        (ZFL_MSG_MAX_PARTS - 1) * sizeof (byte *));
-    memmove (&self->_part_size [1], &self->_part_size [0],
-        (ZFL_MSG_MAX_PARTS - 1) * sizeof (size_t));
-    s_set_part (self, 0, (byte *) part, strlen (part));
-    self->_part_count += 1;
+
+//  --------------------------------------------------------------------------
+//  Push copy of binary data, such as a binary identity, to front of
+//  message parts
+
+void
+zfl_msg_push_data (zfl_msg_t *self, byte *data, size_t size)
+{
+    assert (self);
+    assert (data);
+    s_set_part (self, s_prepend_part (self), data, size);
 }
 
 
 //  --------------------------------------------------------------------------
 //  Pop message part off front of message parts
-//  Caller should free returned string when finished with it
+//  Caller should free returned string when finished with it, using
+//  zfl_pool_free if the message was created with zfl_msg_new_pool
 
 char *
 zfl_msg_pop (zfl_msg_t *self)
@@ -367,12 +823,8 @@ zfl_msg_pop (zfl_msg_t *self)
     assert (self);
     assert (self->_part_count);
 
-    //  Remove first part and move part stack down one element
-    char *part = (char *) self->_part_data [0];
-    memmove (&self->_part_data [0], &self->_part_data [1],
-        (ZFL_MSG_MAX_PARTS - 1) * sizeof (byte *));
-    memmove (&self->_part_size [0], &self->_part_size [1],
-        (ZFL_MSG_MAX_PARTS - 1) * sizeof (size_t));
+    char *part = s_part_string (self, s_part (self, 0));
+    self->_part_head++;
     self->_part_count--;
     return part;
 }
@@ -388,12 +840,30 @@ zfl_msg_address (zfl_msg_t *self)
     assert (self);
 
     if (self->_part_count)
-        return (char *) self->_part_data [0];
+        return s_part_string (self, s_part (self, 0));
     else
         return NULL;
 }
 
 
+//  --------------------------------------------------------------------------
+//  Return size of outer message address, if any, as returned by
+//  zfl_msg_address
+
+size_t
+zfl_msg_address_size (zfl_msg_t *self)
+{
+    assert (self);
+
+    if (self->_part_count) {
+        s_part_string (self, s_part (self, 0));
+        return s_part (self, 0)->size;
+    }
+    else
+        return 0;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Wraps message in new address envelope
 //  If delim is not null, creates two-part envelope
@@ -414,7 +884,8 @@ zfl_msg_wrap (zfl_msg_t *self, char *address, char *delim)
 //  --------------------------------------------------------------------------
 //  Unwraps outer message envelope and returns address
 //  Discards empty message part after address, if any
-//  Caller should free returned string when finished with it
+//  Caller should free returned string when finished with it, as for
+//  zfl_msg_pop
 
 char *
 zfl_msg_unwrap (zfl_msg_t *self)
@@ -422,8 +893,8 @@ zfl_msg_unwrap (zfl_msg_t *self)
     assert (self);
 
     char *address = zfl_msg_pop (self);
-    if (*zfl_msg_address (self) == 0)
-        free (zfl_msg_pop (self));
+    if (self->_part_count && s_part (self, 0)->size == 0)
+        zfl_pool_free (self->_pool, zfl_msg_pop (self));
     return address;
 }
 
@@ -436,13 +907,13 @@ zfl_msg_dump (zfl_msg_t *self)
 {
     uint part_nbr;
     for (part_nbr = 0; part_nbr < self->_part_count; part_nbr++) {
-        byte  *data = self->_part_data [part_nbr];
-        size_t size = self->_part_size [part_nbr];
+        byte  *data = s_part (self, part_nbr)->data;
+        size_t size = s_part (self, part_nbr)->size;
 
         //  Dump the message as text or binary
         int is_text = 1;
         uint char_nbr;
-        for (char_nbr = 0; char_nbr < size; char_nbr++)
+        for (char_nbr = 0; char_nbr < size && is_text; char_nbr++)
             if (data [char_nbr] < 32 || data [char_nbr] > 127)
                 is_text = 0;
 
@@ -462,11 +933,46 @@ zfl_msg_dump (zfl_msg_t *self)
 //  --------------------------------------------------------------------------
 //  Runs self test of class
 
+#define TEST_BATCH      100         //  Messages in flight when benchmarking
+#define TEST_BATCH_MAX  (4 * 1024 * 1024)   //  Most bytes in flight
+
+//  Send and receive messages of the given body size over a pair of inproc
+//  sockets, in batches, and return the throughput in MB/second. We keep
+//  batches of large messages small enough not to hog memory.
+static int
+s_test_throughput (void *output, void *input, size_t size, int messages)
+{
+    int batch = TEST_BATCH;
+    if (size * batch > TEST_BATCH_MAX)
+        batch = size < TEST_BATCH_MAX? (int) (TEST_BATCH_MAX / size): 1;
+
+    byte *body = (byte *) zmalloc (size);
+    int64_t start = zfl_time_now ();
+    int sent;
+    for (sent = 0; sent < messages; sent += batch) {
+        int msg_nbr;
+        for (msg_nbr = 0; msg_nbr < batch; msg_nbr++) {
+            zfl_msg_t *zmsg = zfl_msg_new ();
+            zfl_msg_body_set_data (zmsg, body, size);
+            zfl_msg_send (&zmsg, output);
+        }
+        for (msg_nbr = 0; msg_nbr < batch; msg_nbr++) {
+            zfl_msg_t *zmsg = zfl_msg_recv (input);
+            assert (zfl_msg_body_size (zmsg) == size);
+            zfl_msg_destroy (&zmsg);
+        }
+    }
+    int64_t usecs = zfl_time_now () - start;
+    free (body);
+    return (int) ((double) size * messages / (usecs? usecs: 1));
+}
+
 int
 zfl_msg_test (int verbose)
 {
     zfl_msg_t
-        *zmsg;
+        *zmsg,
+        *copy;
     int rc;
 
     printf (" * zfl_msg: ");
@@ -520,6 +1026,9 @@ zfl_msg_test (int verbose)
     free (zfl_msg_unwrap (zmsg));
     assert (zfl_msg_parts (zmsg) == 4);
     assert (strcmp (zfl_msg_body (zmsg), "World") == 0);
+    zfl_msg_body_fmt (zmsg, "%0300d", 0);
+    assert (zfl_msg_body_size (zmsg) == 300);
+    zfl_msg_body_set (zmsg, "World");
     char *part;
     part = zfl_msg_unwrap (zmsg);
     assert (strcmp (part, "address2") == 0);
@@ -540,9 +1049,186 @@ zfl_msg_test (int verbose)
     zfl_msg_destroy (&zmsg);
     assert (zmsg == NULL);
 
+    //  Large parts are received without copying, forwarded as they are,
+    //  and become C strings when accessed
+    char large [1000];
+    memset (large, 'x', sizeof (large));
+    zmsg = zfl_msg_new ();
+    zfl_msg_body_set_data (zmsg, (byte *) large, sizeof (large));
+    zfl_msg_send (&zmsg, output);
+    zmsg = zfl_msg_recv (input);
+    assert (zfl_msg_parts (zmsg) == 2);
+    copy = zfl_msg_dup (zmsg);
+    zfl_msg_send (&zmsg, input);
+    zmsg = zfl_msg_recv (output);
+    assert (zfl_msg_parts (zmsg) == 1);
+    assert (zfl_msg_body_size (zmsg) == sizeof (large));
+    assert (strlen (zfl_msg_body (zmsg)) == sizeof (large));
+    assert (memcmp (zfl_msg_body (zmsg), large, sizeof (large)) == 0);
+    zfl_msg_destroy (&zmsg);
+    free (zfl_msg_unwrap (copy));
+    assert (zfl_msg_parts (copy) == 1);
+    part = zfl_msg_pop (copy);
+    assert (strlen (part) == sizeof (large));
+    free (part);
+    zfl_msg_destroy (&copy);
+
+    //  Bodies can be filled in place, and trimmed afterwards, including
+    //  a received part
+    zmsg = zfl_msg_new ();
+    byte *body = zfl_msg_body_alloc (zmsg, sizeof (large));
+    memset (body, 'y', sizeof (large));
+    zfl_msg_body_truncate (zmsg, 500);
+    assert (zfl_msg_body_size (zmsg) == 500);
+    assert (strlen (zfl_msg_body (zmsg)) == 500);
+    zfl_msg_send (&zmsg, output);
+    zmsg = zfl_msg_recv (input);
+    assert (zfl_msg_body_size (zmsg) == 500);
+    zfl_msg_body_truncate (zmsg, 100);
+    zfl_msg_send (&zmsg, input);
+    zmsg = zfl_msg_recv (output);
+    assert (zfl_msg_body_size (zmsg) == 100);
+    assert (strspn (zfl_msg_body (zmsg), "y") == 100);
+    zfl_msg_destroy (&zmsg);
+
+    //  Messages can have any number of parts, pushed and popped at either
+    //  end, and keep them in order
+    zmsg = zfl_msg_new ();
+    char name [10];
+    int part_nbr;
+    for (part_nbr = 0; part_nbr < 1000; part_nbr++) {
+        sprintf (name, "%d", part_nbr);
+        if (part_nbr % 2)
+            zfl_msg_push (zmsg, name);
+        else
+            zfl_msg_body_set (zmsg, name);
+    }
+    assert (zfl_msg_parts (zmsg) == 501);
+    assert (streq (zfl_msg_address (zmsg), "999"));
+    assert (streq (zfl_msg_body (zmsg), "998"));
+    for (part_nbr = 0; part_nbr < 300; part_nbr++) {
+        free (zfl_msg_pop (zmsg));
+        zfl_msg_push (zmsg, "x");
+        free (zfl_msg_pop (zmsg));
+    }
+    assert (zfl_msg_parts (zmsg) == 201);
+    assert (streq (zfl_msg_address (zmsg), "399"));
+    zfl_msg_send (&zmsg, output);
+    zmsg = zfl_msg_recv (input);
+    assert (zfl_msg_parts (zmsg) == 202);
+    free (zfl_msg_unwrap (zmsg));
+    assert (streq (zfl_msg_address (zmsg), "399"));
+    assert (streq (zfl_msg_body (zmsg), "998"));
+    zfl_msg_destroy (&zmsg);
+
+    //  Reuse one message to receive and send, and check that destroyed
+    //  messages are reused
+    zmsg = zfl_msg_new ();
+    zfl_msg_body_set (zmsg, "Hello");
+    zfl_msg_send_keep (zmsg, output);
+    assert (zfl_msg_parts (zmsg) == 0);
+    zfl_msg_recv_into (zmsg, input);
+    assert (zfl_msg_parts (zmsg) == 2);
+    zfl_msg_reset (zmsg);
+    assert (zfl_msg_body (zmsg) == NULL);
+    copy = zmsg;
+    zfl_msg_destroy (&zmsg);
+    zmsg = zfl_msg_new ();
+    assert (zmsg == copy);
+    assert (zfl_msg_parts (zmsg) == 0);
+    zfl_msg_destroy (&zmsg);
+
+    //  In binary identity mode, identities stay as 0MQ sent them, and
+    //  strings that look like identities are sent as they are
+    char *lookalike = "@0123456789ABCDEF0123456789ABCDEF";
+    zmsg = zfl_msg_new ();
+    zfl_msg_set_binary_ids (zmsg, TRUE);
+    zfl_msg_body_set (zmsg, lookalike);
+    zfl_msg_send_keep (zmsg, output);
+    zfl_msg_recv_into (zmsg, input);
+    assert (zfl_msg_address_size (zmsg) == 17);
+    assert (zfl_msg_address (zmsg) [0] == 0);
+    byte identity [17];
+    memcpy (identity, zfl_msg_address (zmsg), 17);
+    part = zfl_msg_unwrap (zmsg);
+    zfl_msg_push_data (zmsg, identity, 17);
+    zfl_msg_send_keep (zmsg, input);
+    free (part);
+    zfl_msg_recv_into (zmsg, output);
+    assert (zfl_msg_parts (zmsg) == 1);
+    assert (streq (zfl_msg_body (zmsg), lookalike));
+
+    //  In the default mode, identities become strings when accessed
+    zfl_msg_set_binary_ids (zmsg, FALSE);
+    zfl_msg_send_keep (zmsg, output);
+    zfl_msg_recv_into (zmsg, input);
+    assert (zfl_msg_address_size (zmsg) == 33);
+    char address [34];
+    strcpy (address, zfl_msg_address (zmsg));
+    assert (address [0] == '@');
+    free (zfl_msg_unwrap (zmsg));
+    zfl_msg_wrap (zmsg, address, NULL);
+    zfl_msg_send (&zmsg, input);
+    zmsg = zfl_msg_recv (output);
+    assert (zfl_msg_parts (zmsg) == 1);
+    zfl_msg_destroy (&zmsg);
+
+    //  A body that replaces a received identity-like part is plain data
+    byte uuid_like [17] = { 0 };
+    zmsg = zfl_msg_new ();
+    zfl_msg_body_set_data (zmsg, uuid_like, 17);
+    zfl_msg_send (&zmsg, output);
+    zmsg = zfl_msg_recv (input);
+    zfl_msg_body_set (zmsg, "ABCDEFGHIJKLMNOPQ");
+    assert (streq (zfl_msg_body (zmsg), "ABCDEFGHIJKLMNOPQ"));
+    zfl_msg_body_set_data (zmsg, uuid_like, 17);
+    assert (zfl_msg_body_size (zmsg) == 17);
+    assert (zfl_msg_body (zmsg) [0] == 0);
+    memset (zfl_msg_body_alloc (zmsg, 17), 0, 17);
+    assert (zfl_msg_body_size (zmsg) == 17);
+    assert (zfl_msg_body (zmsg) [0] == 0);
+    zfl_msg_destroy (&zmsg);
+
+    //  Check a message that takes its parts from a pool
+    zfl_pool_t *pool = zfl_pool_new ();
+    zmsg = zfl_msg_new_pool (pool);
+    zfl_msg_body_set (zmsg, "Hello");
+    zfl_msg_body_set (zmsg, "World");
+    zfl_msg_wrap (zmsg, "address1", "");
+    copy = zfl_msg_dup (zmsg);
+    part = zfl_msg_unwrap (zmsg);
+    assert (strcmp (part, "address1") == 0);
+    zfl_pool_free (pool, part);
+    assert (strcmp (zfl_msg_body (zmsg), "World") == 0);
+    zfl_msg_destroy (&zmsg);
+    assert (zfl_msg_parts (copy) == 3);
+    zfl_msg_send (&copy, output);
+    zmsg = zfl_msg_recv (input);
+    assert (zfl_msg_parts (zmsg) == 4);
+    zfl_msg_destroy (&zmsg);
+    zfl_pool_destroy (&pool);
+
     zmq_close (input);
     zmq_close (output);
 
+    //  Measure throughput for small, medium and large bodies; this takes
+    //  a while, so we only do it when verbose
+    if (verbose) {
+        output = zmq_socket (context, ZMQ_PAIR);
+        rc = zmq_bind (output, "inproc://zfl_msg_selftest");
+        assert (rc == 0);
+        input = zmq_socket (context, ZMQ_PAIR);
+        rc = zmq_connect (input, "inproc://zfl_msg_selftest");
+        assert (rc == 0);
+        int small_rate = s_test_throughput (output, input, 64, 100000);
+        int medium_rate = s_test_throughput (output, input, 4096, 20000);
+        int large_rate = s_test_throughput (output, input, 1024 * 1024, 200);
+        printf ("throughput 64B %d, 4KB %d, 1MB %d MB/sec, ",
+            small_rate, medium_rate, large_rate);
+        zmq_close (input);
+        zmq_close (output);
+    }
+
     printf ("OK\n");
     zmq_term (context);
     return 0;
@@ -0,0 +1,341 @@
+/*  =========================================================================
+    zfl_pool.c - memory pool
+
+    Hands out small blocks of memory carved from large chunks, and keeps
+    freed blocks on a freelist per size class so that the next allocation
+    of that size is a couple of pointer moves. Blocks are only returned to
+    the heap when the pool is destroyed.
+
+    A pool is not thread safe. Like a 0MQ socket, it belongs to one thread:
+    each thread that wants pooled containers creates its own pool, and all
+    containers built on that pool stay in that thread. This keeps the fast
+    path free of locks and atomics.
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#include "../include/zfl_prelude.h"
+#include "../include/zfl_time.h"
+#include "../include/zfl_pool.h"
+
+//  Pool parameters
+
+#define CHUNK_SIZE      65536   //  Size of each chunk we carve blocks from
+#define MIN_CLASS       5       //  Smallest block is 1 << MIN_CLASS bytes
+#define CLASSES         8       //  Size classes 32, 64, ... 4096 bytes
+#define LARGE_CLASS     CLASSES //  Class of blocks we got from the heap
+
+//  Each block starts with a header holding its size class; the caller's
+//  data follows the header. A free block holds the freelist link instead.
+
+typedef union {
+    size_t
+        size_class;             //  Index into freelists, or LARGE_CLASS
+    void
+        *alignment;             //  Keep data aligned for pointers
+    double
+        alignment_double;       //  ... and for doubles
+} header_t;
+
+typedef struct _block_t block_t;
+struct _block_t {
+    header_t
+        header;
+    block_t
+        *next;                  //  Next free block, while on freelist
+};
+
+//  Chunks are chained so we can free them on destroy
+
+typedef struct _chunk_t chunk_t;
+struct _chunk_t {
+    chunk_t
+        *next;                  //  Next chunk in pool
+    header_t
+        alignment;              //  Keep blocks aligned
+};
+
+//  Structure of our class
+
+struct _zfl_pool_t {
+    block_t
+        *freelist [CLASSES];    //  Free blocks per size class
+    chunk_t
+        *chunks;                //  All chunks, newest first
+    byte
+        *carve_ptr,             //  Unused space in newest chunk
+        *carve_end;             //  End of newest chunk
+    size_t
+        chunk_count;            //  Number of chunks allocated
+};
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Return size class for a block holding this many bytes of data, or
+//  LARGE_CLASS if the block is too large for the pool.
+
+static inline size_t
+s_size_class (size_t size)
+{
+    size_t size_class = 0;
+    size += sizeof (header_t);
+    while (size > ((size_t) 1 << (size_class + MIN_CLASS)))
+        if (++size_class == CLASSES)
+            break;
+    return size_class;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Carve a fresh block of the specified class from the newest chunk,
+//  allocating a new chunk if needed.
+
+static block_t *
+s_carve_block (zfl_pool_t *self, size_t size_class)
+{
+    size_t block_size = (size_t) 1 << (size_class + MIN_CLASS);
+    if (self->carve_ptr + block_size > self->carve_end) {
+        chunk_t *chunk = (chunk_t *) malloc (CHUNK_SIZE);
+        assert (chunk);
+        chunk->next = self->chunks;
+        self->chunks = chunk;
+        self->chunk_count++;
+        self->carve_ptr = (byte *) chunk + sizeof (chunk_t);
+        self->carve_end = (byte *) chunk + CHUNK_SIZE;
+    }
+    block_t *block = (block_t *) self->carve_ptr;
+    self->carve_ptr += block_size;
+    return block;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zfl_pool_t *
+zfl_pool_new (void)
+{
+    zfl_pool_t
+        *self;
+
+    self = (zfl_pool_t *) zmalloc (sizeof (zfl_pool_t));
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+//  Returns all chunks to the heap. Any blocks still in use become invalid,
+//  so destroy the containers that use a pool before you destroy the pool.
+//  Large blocks that were not freed are not tracked and will leak.
+
+void
+zfl_pool_destroy (zfl_pool_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zfl_pool_t *self = *self_p;
+        while (self->chunks) {
+            chunk_t *next = self->chunks->next;
+            free (self->chunks);
+            self->chunks = next;
+        }
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Allocate a block of at least the specified size. The block is not
+//  zeroed. Blocks up to a few KB come from the pool; larger ones come
+//  from the heap. If self is NULL, allocates from the heap, so containers
+//  can call this whether or not they were given a pool.
+
+void *
+zfl_pool_alloc (zfl_pool_t *self, size_t size)
+{
+    if (!self) {
+        void *data = malloc (size);
+        assert (data);
+        return data;
+    }
+    block_t *block;
+    size_t size_class = s_size_class (size);
+    if (size_class == LARGE_CLASS) {
+        block = (block_t *) malloc (sizeof (header_t) + size);
+        assert (block);
+    }
+    else
+    if (self->freelist [size_class]) {
+        block = self->freelist [size_class];
+        self->freelist [size_class] = block->next;
+    }
+    else
+        block = s_carve_block (self, size_class);
+
+    block->header.size_class = size_class;
+    return (byte *) block + sizeof (header_t);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a block to the pool it came from. If self is NULL, frees the
+//  block to the heap, matching zfl_pool_alloc. Does nothing if data is
+//  NULL.
+
+void
+zfl_pool_free (zfl_pool_t *self, void *data)
+{
+    if (!data)
+        return;
+    if (!self) {
+        free (data);
+        return;
+    }
+    block_t *block = (block_t *) ((byte *) data - sizeof (header_t));
+    size_t size_class = block->header.size_class;
+    if (size_class == LARGE_CLASS)
+        free (block);
+    else {
+        assert (size_class < CLASSES);
+        block->next = self->freelist [size_class];
+        self->freelist [size_class] = block;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a copy of the string, allocated from the pool
+
+char *
+zfl_pool_strdup (zfl_pool_t *self, char *string)
+{
+    assert (string);
+    size_t size = strlen (string) + 1;
+    char *copy = (char *) zfl_pool_alloc (self, size);
+    memcpy (copy, string, size);
+    return copy;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of chunks the pool has taken from the heap
+
+size_t
+zfl_pool_chunks (zfl_pool_t *self)
+{
+    assert (self);
+    return self->chunk_count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+#define TEST_BLOCKS     1000    //  Blocks held at once
+#define TEST_CYCLES     10000   //  Times we free and reallocate them,
+                                //  if verbose
+#define TEST_QUICK      100     //  Times we do that, otherwise
+
+//  Allocate and free blocks of mixed sizes, return elapsed microseconds
+static int64_t
+s_test_churn (zfl_pool_t *pool, int cycles)
+{
+    void **blocks = (void **) zmalloc (TEST_BLOCKS * sizeof (void *));
+    int64_t start = zfl_time_now ();
+    int cycle, block_nbr;
+    for (cycle = 0; cycle < cycles; cycle++) {
+        for (block_nbr = 0; block_nbr < TEST_BLOCKS; block_nbr++) {
+            size_t size = 16 + (block_nbr % 8) * 8;
+            blocks [block_nbr] = zfl_pool_alloc (pool, size);
+            memset (blocks [block_nbr], block_nbr, size);
+        }
+        for (block_nbr = 0; block_nbr < TEST_BLOCKS; block_nbr++)
+            zfl_pool_free (pool, blocks [block_nbr]);
+    }
+    int64_t elapsed = zfl_time_now () - start;
+    free (blocks);
+    return elapsed;
+}
+
+int
+zfl_pool_test (Bool verbose)
+{
+    zfl_pool_t
+        *pool;
+
+    printf (" * zfl_pool: ");
+    pool = zfl_pool_new ();
+    assert (pool);
+    assert (zfl_pool_chunks (pool) == 0);
+
+    //  Blocks are distinct, aligned, and reused once freed
+    char *first = (char *) zfl_pool_alloc (pool, 10);
+    char *second = (char *) zfl_pool_alloc (pool, 10);
+    assert (first && second && first != second);
+    assert (((size_t) first & (sizeof (void *) - 1)) == 0);
+    strcpy (first, "first");
+    strcpy (second, "second");
+    assert (zfl_pool_chunks (pool) == 1);
+    zfl_pool_free (pool, first);
+    char *third = (char *) zfl_pool_alloc (pool, 12);
+    assert (third == first);
+    assert (streq (second, "second"));
+    zfl_pool_free (pool, second);
+    zfl_pool_free (pool, third);
+    zfl_pool_free (pool, NULL);
+
+    //  Large blocks come from the heap
+    byte *large = (byte *) zfl_pool_alloc (pool, 100000);
+    memset (large, 0, 100000);
+    zfl_pool_free (pool, large);
+
+    char *string = zfl_pool_strdup (pool, "Hello, World");
+    assert (streq (string, "Hello, World"));
+    zfl_pool_free (pool, string);
+
+    //  A NULL pool uses the heap
+    string = zfl_pool_strdup (NULL, "Hello, World");
+    assert (streq (string, "Hello, World"));
+    zfl_pool_free (NULL, string);
+
+    //  Churn through blocks; the pool should not keep growing. We only do
+    //  a full benchmark when verbose, since that's when we report it
+    int cycles = verbose? TEST_CYCLES: TEST_QUICK;
+    int64_t pool_usecs = s_test_churn (pool, cycles);
+    size_t chunks = zfl_pool_chunks (pool);
+    s_test_churn (pool, cycles);
+    assert (zfl_pool_chunks (pool) == chunks);
+    int64_t heap_usecs = s_test_churn (NULL, cycles);
+    if (verbose)
+        printf ("%d blocks: pool %d msecs, heap %d msecs, ",
+            TEST_BLOCKS * cycles,
+            (int) (pool_usecs / 1000), (int) (heap_usecs / 1000));
+
+    zfl_pool_destroy (&pool);
+    assert (pool == NULL);
+
+    printf ("OK\n");
+    return 0;
+}
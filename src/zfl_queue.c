@@ -0,0 +1,546 @@
+/*  =========================================================================
+    zfl_queue.c - chunked queue
+
+    Queue of void pointers, held in fixed-size chunks rather than one node
+    per value. Adding and removing values at either end takes constant time,
+    and we keep the last chunk we emptied as a spare, so a queue whose size
+    stays within a chunk or so of steady does not allocate at all.
+
+    The queue can have a high-water mark, with one of two policies. With
+    ZFL_QUEUE_DROP, adding a value to a full queue fails and the caller
+    keeps the value. With ZFL_QUEUE_BLOCK, adding waits until another thread
+    pops a value; the queue then locks itself on every call, so that one
+    thread can feed it while another drains it.
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#include "../include/zfl_prelude.h"
+#include "../include/zfl_time.h"
+#include "../include/zfl_pool.h"
+#include "../include/zfl_list.h"
+#include "../include/zfl_thread.h"
+#include "../include/zfl_queue.h"
+
+#define CHUNK_SIZE      256     //  Values per chunk
+
+//  Chunk of values; chunks form a doubly-linked list from head to tail
+
+typedef struct _chunk_t chunk_t;
+struct _chunk_t {
+    void
+        *values [CHUNK_SIZE];
+    chunk_t
+        *prev,
+        *next;
+};
+
+//  Structure of our class
+
+struct _zfl_queue_t {
+    chunk_t
+        *head,                  //  Chunk holding first value
+        *tail,                  //  Chunk holding last value
+        *spare;                 //  Emptied chunk kept for reuse
+    size_t
+        head_pos,               //  Index of first value in head chunk
+        tail_pos,               //  Index after last value in tail chunk
+        size,                   //  Number of values in queue
+        hwm;                    //  High-water mark, or zero
+    int
+        policy;                 //  What to do at high-water mark
+#if defined (__UNIX__)
+    pthread_mutex_t
+        mutex;                  //  Used if policy is ZFL_QUEUE_BLOCK
+    pthread_cond_t
+        not_full;               //  Signalled when a value leaves
+#elif defined (__WINDOWS__)
+    CRITICAL_SECTION
+        mutex;
+    CONDITION_VARIABLE
+        not_full;
+#else
+#   error "Platform not supported by zfl_queue class"
+#endif
+};
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Lock and unlock the queue, if it is shared between threads
+
+static inline void
+s_lock (zfl_queue_t *self)
+{
+    if (self->policy == ZFL_QUEUE_BLOCK) {
+#if defined (__UNIX__)
+        int rc = pthread_mutex_lock (&self->mutex);
+        assert (rc == 0);
+#elif defined (__WINDOWS__)
+        EnterCriticalSection (&self->mutex);
+#endif
+    }
+}
+
+static inline void
+s_unlock (zfl_queue_t *self)
+{
+    if (self->policy == ZFL_QUEUE_BLOCK) {
+#if defined (__UNIX__)
+        int rc = pthread_mutex_unlock (&self->mutex);
+        assert (rc == 0);
+#elif defined (__WINDOWS__)
+        LeaveCriticalSection (&self->mutex);
+#endif
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Wait until there is room for another value, or return -1 if the queue
+//  is full and drops new values. Caller holds the lock.
+
+static int
+s_wait_for_room (zfl_queue_t *self)
+{
+    if (self->hwm == 0 || self->size < self->hwm)
+        return 0;
+    if (self->policy == ZFL_QUEUE_DROP)
+        return -1;
+
+    while (self->size >= self->hwm) {
+#if defined (__UNIX__)
+        int rc = pthread_cond_wait (&self->not_full, &self->mutex);
+        assert (rc == 0);
+#elif defined (__WINDOWS__)
+        SleepConditionVariableCS (&self->not_full, &self->mutex, INFINITE);
+#endif
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Tell any thread waiting for room that a value has left the queue.
+//  Caller holds the lock.
+
+static void
+s_signal_room (zfl_queue_t *self)
+{
+    if (self->policy == ZFL_QUEUE_BLOCK) {
+#if defined (__UNIX__)
+        int rc = pthread_cond_signal (&self->not_full);
+        assert (rc == 0);
+#elif defined (__WINDOWS__)
+        WakeConditionVariable (&self->not_full);
+#endif
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Get a chunk, using the spare if we have one; and release a chunk, keeping
+//  it as the spare if we don't.
+
+static chunk_t *
+s_chunk_new (zfl_queue_t *self)
+{
+    chunk_t *chunk = self->spare;
+    if (chunk)
+        self->spare = NULL;
+    else {
+        chunk = (chunk_t *) malloc (sizeof (chunk_t));
+        assert (chunk);
+    }
+    return chunk;
+}
+
+static void
+s_chunk_release (zfl_queue_t *self, chunk_t *chunk)
+{
+    if (self->spare)
+        free (chunk);
+    else
+        self->spare = chunk;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Remove the last value from the queue, and move the positions back to the
+//  middle of the single chunk when the queue becomes empty, so that both
+//  ends have room to grow.
+
+static void
+s_value_removed (zfl_queue_t *self)
+{
+    if (--self->size == 0) {
+        assert (self->head == self->tail);
+        self->head_pos = self->tail_pos = CHUNK_SIZE / 2;
+    }
+    s_signal_room (self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zfl_queue_t *
+zfl_queue_new (void)
+{
+    zfl_queue_t
+        *self;
+
+    self = (zfl_queue_t *) zmalloc (sizeof (zfl_queue_t));
+    self->head = self->tail = s_chunk_new (self);
+    self->head->prev = self->head->next = NULL;
+    self->head_pos = self->tail_pos = CHUNK_SIZE / 2;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+//  Does not free the values still in the queue.
+
+void
+zfl_queue_destroy (zfl_queue_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zfl_queue_t *self = *self_p;
+        while (self->head) {
+            chunk_t *next = self->head->next;
+            free (self->head);
+            self->head = next;
+        }
+        free (self->spare);
+        if (self->policy == ZFL_QUEUE_BLOCK) {
+#if defined (__UNIX__)
+            pthread_cond_destroy (&self->not_full);
+            pthread_mutex_destroy (&self->mutex);
+#elif defined (__WINDOWS__)
+            DeleteCriticalSection (&self->mutex);
+#endif
+        }
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set high-water mark and the policy to apply when the queue reaches it,
+//  ZFL_QUEUE_DROP or ZFL_QUEUE_BLOCK. A high-water mark of zero means the
+//  queue has no limit. Call this once, before you share the queue with
+//  other threads.
+
+void
+zfl_queue_set_hwm (zfl_queue_t *self, size_t hwm, int policy)
+{
+    assert (self);
+    assert (policy == ZFL_QUEUE_DROP || policy == ZFL_QUEUE_BLOCK);
+    assert (self->policy == 0 || self->policy == policy);
+
+    if (policy == ZFL_QUEUE_BLOCK && self->policy == 0) {
+#if defined (__UNIX__)
+        int rc = pthread_mutex_init (&self->mutex, NULL);
+        assert (rc == 0);
+        rc = pthread_cond_init (&self->not_full, NULL);
+        assert (rc == 0);
+#elif defined (__WINDOWS__)
+        InitializeCriticalSection (&self->mutex);
+        InitializeConditionVariable (&self->not_full);
+#endif
+    }
+    self->policy = policy;
+    self->hwm = hwm;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add value to the end of the queue. Value may not be NULL. Returns 0 on
+//  success, or -1 if the queue is at its high-water mark and drops new
+//  values, in which case the caller still owns the value.
+
+int
+zfl_queue_append (zfl_queue_t *self, void *value)
+{
+    assert (self);
+    assert (value);
+
+    s_lock (self);
+    int rc = s_wait_for_room (self);
+    if (rc == 0) {
+        if (self->tail_pos == CHUNK_SIZE) {
+            chunk_t *chunk = s_chunk_new (self);
+            chunk->prev = self->tail;
+            chunk->next = NULL;
+            self->tail->next = chunk;
+            self->tail = chunk;
+            self->tail_pos = 0;
+        }
+        self->tail->values [self->tail_pos++] = value;
+        self->size++;
+    }
+    s_unlock (self);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add value to the front of the queue, as for zfl_queue_append.
+
+int
+zfl_queue_push (zfl_queue_t *self, void *value)
+{
+    assert (self);
+    assert (value);
+
+    s_lock (self);
+    int rc = s_wait_for_room (self);
+    if (rc == 0) {
+        if (self->head_pos == 0) {
+            chunk_t *chunk = s_chunk_new (self);
+            chunk->prev = NULL;
+            chunk->next = self->head;
+            self->head->prev = chunk;
+            self->head = chunk;
+            self->head_pos = CHUNK_SIZE;
+        }
+        self->head->values [--self->head_pos] = value;
+        self->size++;
+    }
+    s_unlock (self);
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove and return the value at the front of the queue, or NULL if the
+//  queue is empty.
+
+void *
+zfl_queue_pop (zfl_queue_t *self)
+{
+    assert (self);
+
+    void *value = NULL;
+    s_lock (self);
+    if (self->size) {
+        value = self->head->values [self->head_pos++];
+        if (self->head_pos == CHUNK_SIZE && self->head != self->tail) {
+            chunk_t *chunk = self->head;
+            self->head = chunk->next;
+            self->head->prev = NULL;
+            self->head_pos = 0;
+            s_chunk_release (self, chunk);
+        }
+        s_value_removed (self);
+    }
+    s_unlock (self);
+    return value;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove and return the value at the end of the queue, or NULL if the
+//  queue is empty.
+
+void *
+zfl_queue_pop_tail (zfl_queue_t *self)
+{
+    assert (self);
+
+    void *value = NULL;
+    s_lock (self);
+    if (self->size) {
+        value = self->tail->values [--self->tail_pos];
+        if (self->tail_pos == 0 && self->head != self->tail) {
+            chunk_t *chunk = self->tail;
+            self->tail = chunk->prev;
+            self->tail->next = NULL;
+            self->tail_pos = CHUNK_SIZE;
+            s_chunk_release (self, chunk);
+        }
+        s_value_removed (self);
+    }
+    s_unlock (self);
+    return value;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the value at the front of the queue, or NULL if the queue is
+//  empty, without removing it.
+
+void *
+zfl_queue_first (zfl_queue_t *self)
+{
+    assert (self);
+
+    s_lock (self);
+    void *value = self->size? self->head->values [self->head_pos]: NULL;
+    s_unlock (self);
+    return value;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of values in the queue
+
+size_t
+zfl_queue_size (zfl_queue_t *self)
+{
+    assert (self);
+
+    s_lock (self);
+    size_t size = self->size;
+    s_unlock (self);
+    return size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+#define TEST_PAIRS      10000000    //  Enqueue/dequeue pairs in benchmark,
+                                    //  if verbose
+#define TEST_QUICK      10000       //  Pairs we do otherwise
+#define TEST_DEPTH      1000        //  Values held while we run it
+#define TEST_HANDOFFS   1000        //  Values passed between threads
+
+//  Producer thread fills a blocking queue faster than we drain it
+static void *
+s_test_producer (void *args)
+{
+    zfl_queue_t *queue = (zfl_queue_t *) args;
+    size_t value;
+    for (value = 1; value <= TEST_HANDOFFS; value++) {
+        int rc = zfl_queue_append (queue, (void *) value);
+        assert (rc == 0);
+        assert (zfl_queue_size (queue) <= 10);
+    }
+    return NULL;
+}
+
+int
+zfl_queue_test (Bool verbose)
+{
+    zfl_queue_t
+        *queue;
+
+    printf (" * zfl_queue: ");
+    queue = zfl_queue_new ();
+    assert (queue);
+    assert (zfl_queue_size (queue) == 0);
+    assert (zfl_queue_pop (queue) == NULL);
+    assert (zfl_queue_pop_tail (queue) == NULL);
+
+    //  Values are void *, not particularly strings
+    char *cheese = "boursin";
+    char *bread = "baguette";
+    char *wine = "bordeaux";
+
+    zfl_queue_append (queue, bread);
+    zfl_queue_append (queue, wine);
+    zfl_queue_push (queue, cheese);
+    assert (zfl_queue_size (queue) == 3);
+    assert (zfl_queue_first (queue) == cheese);
+    assert (zfl_queue_pop (queue) == cheese);
+    assert (zfl_queue_pop_tail (queue) == wine);
+    assert (zfl_queue_pop (queue) == bread);
+    assert (zfl_queue_size (queue) == 0);
+
+    //  Fill and drain across many chunks from both ends
+    size_t value;
+    for (value = 1; value <= 10000; value++)
+        if (value % 2)
+            zfl_queue_append (queue, (void *) value);
+        else
+            zfl_queue_push (queue, (void *) value);
+    assert (zfl_queue_size (queue) == 10000);
+    for (value = 10000; value > 0; value -= 2)
+        assert (zfl_queue_pop (queue) == (void *) value);
+    for (value = 9999; value < 10000; value -= 2)
+        assert (zfl_queue_pop_tail (queue) == (void *) value);
+    assert (zfl_queue_size (queue) == 0);
+
+    //  Drop policy refuses values over the high-water mark
+    zfl_queue_set_hwm (queue, 3, ZFL_QUEUE_DROP);
+    assert (zfl_queue_append (queue, cheese) == 0);
+    assert (zfl_queue_append (queue, bread) == 0);
+    assert (zfl_queue_push (queue, wine) == 0);
+    assert (zfl_queue_append (queue, cheese) == -1);
+    assert (zfl_queue_push (queue, cheese) == -1);
+    assert (zfl_queue_size (queue) == 3);
+    zfl_queue_destroy (&queue);
+    assert (queue == NULL);
+
+    //  Block policy makes a fast producer wait for a slow consumer
+    queue = zfl_queue_new ();
+    zfl_queue_set_hwm (queue, 10, ZFL_QUEUE_BLOCK);
+    zfl_thread_t *producer = zfl_thread_new (s_test_producer, queue);
+    assert (producer);
+    size_t expect = 1;
+    while (expect <= TEST_HANDOFFS) {
+        void *item = zfl_queue_pop (queue);
+        if (item)
+            assert (item == (void *) expect++);
+    }
+    zfl_thread_wait (producer);
+    zfl_thread_destroy (&producer);
+    zfl_queue_destroy (&queue);
+
+    //  Benchmark enqueue/dequeue pairs against zfl_list. We only do a full
+    //  run when verbose, since that's when we report the results
+    size_t pairs = verbose? TEST_PAIRS: TEST_QUICK;
+    queue = zfl_queue_new ();
+    int64_t start = zfl_time_now ();
+    for (value = 1; value <= pairs; value++) {
+        zfl_queue_append (queue, (void *) value);
+        if (value > TEST_DEPTH)
+            zfl_queue_pop (queue);
+    }
+    int64_t queue_usecs = zfl_time_now () - start;
+    assert (zfl_queue_size (queue) == TEST_DEPTH);
+    zfl_queue_destroy (&queue);
+
+    zfl_list_t *list = zfl_list_new ();
+    start = zfl_time_now ();
+    for (value = 1; value <= pairs; value++) {
+        zfl_list_append (list, (void *) value);
+        if (value > TEST_DEPTH)
+            zfl_list_remove (list, zfl_list_first (list));
+    }
+    int64_t list_usecs = zfl_time_now () - start;
+    assert (zfl_list_size (list) == TEST_DEPTH);
+    zfl_list_destroy (&list);
+    if (verbose)
+        printf ("%d pairs: queue %d msecs, list %d msecs, ", (int) pairs,
+            (int) (queue_usecs / 1000), (int) (list_usecs / 1000));
+
+    printf ("OK\n");
+    return 0;
+}
@@ -0,0 +1,720 @@
+/*  =========================================================================
+    zfl_ring.c - lock-free ring
+
+    Bounded ring of void pointers for passing work between threads without
+    locks or copies, e.g. handing zfl_msg_t pointers to an agent thread. A
+    ZFL_RING_SPSC ring allows exactly one producer and one consumer thread
+    and costs one release store per push or pop. A ZFL_RING_MPMC ring allows
+    any number of producers and consumers; each cell carries a sequence
+    number, as in Dmitry Vyukov's bounded MPMC queue, and threads claim
+    cells with a compare-and-swap on the head or tail. Batch calls claim
+    and publish many cells at once, so the atomics cost is paid once per
+    batch rather than once per value.
+
+    Producer and consumer indexes sit on separate cache lines, and each
+    side caches the other side's index, so that in the SPSC case the two
+    threads only touch each other's cache lines when the ring looks full
+    or empty. The ring never blocks: push fails when the ring is full and
+    pop returns NULL when it is empty, and the caller decides how to wait.
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#include <zmq.h>
+#include "../include/zfl_prelude.h"
+#include "../include/zfl_thread.h"
+#include "../include/zfl_time.h"
+#include "../include/zfl_ring.h"
+
+#define PAD_SIZE        128     //  Keeps producer and consumer data apart
+
+//  One cell of the ring. The sequence number tells MPMC producers and
+//  consumers whose turn it is to use the cell; SPSC rings don't use it.
+
+typedef struct {
+    volatile size_t
+        sequence;
+    void
+        *value;
+} cell_t;
+
+//  Structure of our class
+
+struct _zfl_ring_t {
+    cell_t
+        *cells;                 //  Array of cells, power of two
+    size_t
+        mask;                   //  Number of cells - 1
+    int
+        type;                   //  ZFL_RING_SPSC or ZFL_RING_MPMC
+    byte
+        pad1 [PAD_SIZE];
+    volatile size_t
+        tail;                   //  Next cell to push into
+    size_t
+        head_cache;             //  Producer's last view of head
+    byte
+        pad2 [PAD_SIZE];
+    volatile size_t
+        head;                   //  Next cell to pop from
+    size_t
+        tail_cache;             //  Consumer's last view of tail
+    byte
+        pad3 [PAD_SIZE];
+};
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Atomic operations on ring indexes and cell sequence numbers
+
+#if defined (__GNUC__)
+static inline size_t
+s_load_acquire (volatile size_t *index)
+{
+    return __atomic_load_n (index, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+s_store_release (volatile size_t *index, size_t value)
+{
+    __atomic_store_n (index, value, __ATOMIC_RELEASE);
+}
+
+static inline Bool
+s_compare_swap (volatile size_t *index, size_t expected, size_t value)
+{
+    return __atomic_compare_exchange_n (index, &expected, value,
+        FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+#elif defined (__WINDOWS__)
+static inline size_t
+s_load_acquire (volatile size_t *index)
+{
+    size_t value = *index;
+    MemoryBarrier ();
+    return value;
+}
+
+static inline void
+s_store_release (volatile size_t *index, size_t value)
+{
+    MemoryBarrier ();
+    *index = value;
+}
+
+static inline Bool
+s_compare_swap (volatile size_t *index, size_t expected, size_t value)
+{
+    return InterlockedCompareExchangePointer ((PVOID volatile *) index,
+        (PVOID) value, (PVOID) expected) == (PVOID) expected;
+}
+#else
+#   error "Platform not supported by zfl_ring class"
+#endif
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Push and pop for single-producer, single-consumer rings. Each side owns
+//  its own index and only reads the other side's index when its cached
+//  copy says there is no room, or nothing to pop.
+
+static size_t
+s_spsc_push (zfl_ring_t *self, void **values, size_t count)
+{
+    size_t tail = self->tail;
+    size_t room = self->mask + 1 - (tail - self->head_cache);
+    if (room < count) {
+        self->head_cache = s_load_acquire (&self->head);
+        room = self->mask + 1 - (tail - self->head_cache);
+        if (count > room)
+            count = room;
+    }
+    size_t index;
+    for (index = 0; index < count; index++)
+        self->cells [(tail + index) & self->mask].value = values [index];
+    if (count)
+        s_store_release (&self->tail, tail + count);
+    return count;
+}
+
+static size_t
+s_spsc_pop (zfl_ring_t *self, void **values, size_t count)
+{
+    size_t head = self->head;
+    size_t ready = self->tail_cache - head;
+    if (ready < count) {
+        self->tail_cache = s_load_acquire (&self->tail);
+        ready = self->tail_cache - head;
+        if (count > ready)
+            count = ready;
+    }
+    size_t index;
+    for (index = 0; index < count; index++)
+        values [index] = self->cells [(head + index) & self->mask].value;
+    if (count)
+        s_store_release (&self->head, head + count);
+    return count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper function
+//  Claim up to count cells starting at the shared index, for pushing if
+//  lag is 0 or for popping if lag is 1. A cell is ready for us when its
+//  sequence number equals its position plus lag. Returns the number of
+//  cells claimed, and the position of the first one in *position_p.
+
+static size_t
+s_mpmc_claim (zfl_ring_t *self, volatile size_t *shared, size_t lag,
+              size_t count, size_t *position_p)
+{
+    size_t position = s_load_acquire (shared);
+    FOREVER {
+        size_t claimed = 0;
+        Bool stale = FALSE;
+        while (claimed < count) {
+            cell_t *cell = &self->cells [(position + claimed) & self->mask];
+            size_t sequence = s_load_acquire (&cell->sequence);
+            ptrdiff_t distance = (ptrdiff_t) (sequence - (position + claimed + lag));
+            if (distance == 0)
+                claimed++;
+            else {
+                //  Cell is behind us if the ring is full or empty, and
+                //  ahead of us if another thread claimed it already
+                stale = distance > 0;
+                break;
+            }
+        }
+        if (claimed && s_compare_swap (shared, position, position + claimed)) {
+            *position_p = position;
+            return claimed;
+        }
+        if (claimed == 0 && !stale)
+            return 0;
+        position = s_load_acquire (shared);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Local helper functions
+//  Push and pop for multi-producer, multi-consumer rings. Once a thread
+//  has claimed cells it fills or empties them, and then hands each cell on
+//  by moving its sequence number forwards.
+
+static size_t
+s_mpmc_push (zfl_ring_t *self, void **values, size_t count)
+{
+    size_t position;
+    count = s_mpmc_claim (self, &self->tail, 0, count, &position);
+    size_t index;
+    for (index = 0; index < count; index++) {
+        cell_t *cell = &self->cells [(position + index) & self->mask];
+        cell->value = values [index];
+        s_store_release (&cell->sequence, position + index + 1);
+    }
+    return count;
+}
+
+static size_t
+s_mpmc_pop (zfl_ring_t *self, void **values, size_t count)
+{
+    size_t position;
+    count = s_mpmc_claim (self, &self->head, 1, count, &position);
+    size_t index;
+    for (index = 0; index < count; index++) {
+        cell_t *cell = &self->cells [(position + index) & self->mask];
+        values [index] = cell->value;
+        s_store_release (&cell->sequence, position + index + self->mask + 1);
+    }
+    return count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+//  Creates a ring of the specified type, ZFL_RING_SPSC or ZFL_RING_MPMC,
+//  holding at least size values. Size is rounded up to a power of two.
+
+zfl_ring_t *
+zfl_ring_new (size_t size, int type)
+{
+    zfl_ring_t
+        *self;
+
+    assert (size > 0);
+    assert (type == ZFL_RING_SPSC || type == ZFL_RING_MPMC);
+    self = (zfl_ring_t *) zmalloc (sizeof (zfl_ring_t));
+    self->type = type;
+    size_t cells = 1;
+    while (cells < size)
+        cells <<= 1;
+    self->mask = cells - 1;
+    self->cells = (cell_t *) zmalloc (cells * sizeof (cell_t));
+    size_t index;
+    for (index = 0; index < cells; index++)
+        self->cells [index].sequence = index;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+//  Does not free the values still in the ring.
+
+void
+zfl_ring_destroy (zfl_ring_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zfl_ring_t *self = *self_p;
+        free (self->cells);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Push value onto the ring. Value may not be NULL. Returns 0 on success,
+//  or -1 if the ring is full, in which case the caller still owns the
+//  value.
+
+int
+zfl_ring_push (zfl_ring_t *self, void *value)
+{
+    assert (self);
+    assert (value);
+    return zfl_ring_push_batch (self, &value, 1) == 1? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Pop the oldest value off the ring, or return NULL if the ring is empty.
+
+void *
+zfl_ring_pop (zfl_ring_t *self)
+{
+    assert (self);
+    void *value;
+    return zfl_ring_pop_batch (self, &value, 1) == 1? value: NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Push up to count values onto the ring, in order, as far as there is
+//  room. Returns the number of values pushed; the caller still owns the
+//  rest.
+
+size_t
+zfl_ring_push_batch (zfl_ring_t *self, void **values, size_t count)
+{
+    assert (self);
+    assert (values);
+    if (self->type == ZFL_RING_SPSC)
+        return s_spsc_push (self, values, count);
+    else
+        return s_mpmc_push (self, values, count);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Pop up to count of the oldest values off the ring into the values
+//  array. Returns the number of values popped, zero if the ring is empty.
+
+size_t
+zfl_ring_pop_batch (zfl_ring_t *self, void **values, size_t count)
+{
+    assert (self);
+    assert (values);
+    if (self->type == ZFL_RING_SPSC)
+        return s_spsc_pop (self, values, count);
+    else
+        return s_mpmc_pop (self, values, count);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of values in the ring. While other threads are using
+//  the ring this is only a snapshot.
+
+size_t
+zfl_ring_size (zfl_ring_t *self)
+{
+    assert (self);
+    size_t head = s_load_acquire (&self->head);
+    size_t tail = s_load_acquire (&self->tail);
+    return tail > head? tail - head: 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+#define TEST_VALUES     1000000     //  Values passed between threads
+#define TEST_ROUNDS     10000       //  Round trips in latency test
+#define TEST_BATCH      64          //  Values per batch
+#define TEST_PRODUCERS  2           //  Threads pushing onto MPMC ring
+#define TEST_CONSUMERS  2           //  Threads popping off MPMC ring
+#define TEST_ENDPOINT   "inproc://zfl_ring_selftest"
+
+typedef struct {
+    zfl_ring_t
+        *ring,                  //  Ring to push onto, or pop from
+        *reply;                 //  Ring to echo values back on
+    void
+        *context;               //  0MQ context for inproc tests
+    size_t
+        first,                  //  Producer pushes first to last
+        last,
+        count,                  //  Consumer counts values...
+        sum;                    //  ... and adds them up
+} test_args_t;
+
+//  Let other threads run while we wait on the ring
+static void
+s_test_yield (void)
+{
+#if (defined (__UNIX__))
+    sched_yield ();
+#else
+    Sleep (0);
+#endif
+}
+
+//  Push values first to last, in batches of varying size
+static void *
+s_test_producer (void *args)
+{
+    test_args_t *test = (test_args_t *) args;
+    void *batch [TEST_BATCH];
+    size_t value = test->first;
+    while (value <= test->last) {
+        size_t count = 0;
+        while (count < 1 + value % TEST_BATCH && value + count <= test->last) {
+            batch [count] = (void *) (value + count);
+            count++;
+        }
+        size_t pushed = 0;
+        while (pushed < count) {
+            size_t rc = zfl_ring_push_batch (test->ring, batch + pushed, count - pushed);
+            if (rc == 0)
+                s_test_yield ();
+            pushed += rc;
+        }
+        value += count;
+    }
+    return NULL;
+}
+
+//  Pop values until we see a done marker, checking that values from each
+//  producer arrive in order
+static void *
+s_test_consumer (void *args)
+{
+    test_args_t *test = (test_args_t *) args;
+    size_t latest [TEST_PRODUCERS] = { 0 };
+    FOREVER {
+        void *batch [TEST_BATCH];
+        size_t count = zfl_ring_pop_batch (test->ring, batch, 1 + test->count % TEST_BATCH);
+        if (count == 0) {
+            s_test_yield ();
+            continue;
+        }
+        size_t index;
+        for (index = 0; index < count; index++) {
+            size_t value = (size_t) batch [index];
+            if (value % (TEST_VALUES * 2) == 0) {
+                //  Done marker; give back the other markers, if any
+                size_t rest = count - index - 1;
+                while (rest)
+                    rest -= zfl_ring_push_batch (test->ring, batch + count - rest, rest);
+                return NULL;
+            }
+            size_t producer = value / (TEST_VALUES * 2);
+            assert (producer < TEST_PRODUCERS);
+            assert (value > latest [producer]);
+            latest [producer] = value;
+            test->count++;
+            test->sum += value;
+        }
+    }
+}
+
+//  Echo values from one ring back on another
+static void *
+s_test_ring_echo (void *args)
+{
+    test_args_t *test = (test_args_t *) args;
+    int round;
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        void *value;
+        while ((value = zfl_ring_pop (test->ring)) == NULL)
+            s_test_yield ();
+        while (zfl_ring_push (test->reply, value))
+            s_test_yield ();
+    }
+    return NULL;
+}
+
+//  Send pointers over inproc, as we would without a ring
+static void *
+s_test_inproc_producer (void *args)
+{
+    test_args_t *test = (test_args_t *) args;
+    void *socket = zmq_socket (test->context, ZMQ_PAIR);
+    int rc = zmq_connect (socket, TEST_ENDPOINT);
+    assert (rc == 0);
+    size_t value;
+    for (value = test->first; value <= test->last; value++) {
+        zmq_msg_t message;
+        zmq_msg_init_size (&message, sizeof (void *));
+        memcpy (zmq_msg_data (&message), &value, sizeof (void *));
+        rc = zmq_send (socket, &message, 0);
+        assert (rc == 0);
+        zmq_msg_close (&message);
+    }
+    zmq_close (socket);
+    return NULL;
+}
+
+//  Echo messages back over inproc
+static void *
+s_test_inproc_echo (void *args)
+{
+    test_args_t *test = (test_args_t *) args;
+    void *socket = zmq_socket (test->context, ZMQ_PAIR);
+    int rc = zmq_connect (socket, TEST_ENDPOINT);
+    assert (rc == 0);
+    int round;
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        zmq_msg_t message;
+        zmq_msg_init (&message);
+        rc = zmq_recv (socket, &message, 0);
+        assert (rc == 0);
+        rc = zmq_send (socket, &message, 0);
+        assert (rc == 0);
+        zmq_msg_close (&message);
+    }
+    zmq_close (socket);
+    return NULL;
+}
+
+//  Time passing TEST_VALUES values through a ring of the given type
+static int64_t
+s_test_ring_throughput (int type)
+{
+    test_args_t test = { NULL };
+    test.ring = zfl_ring_new (1024, type);
+    test.first = 1;
+    test.last = TEST_VALUES;
+    int64_t start = zfl_time_now ();
+    zfl_thread_t *producer = zfl_thread_new (s_test_producer, &test);
+    size_t expect = 1;
+    while (expect <= TEST_VALUES) {
+        void *batch [TEST_BATCH];
+        size_t count = zfl_ring_pop_batch (test.ring, batch, TEST_BATCH);
+        if (count == 0)
+            s_test_yield ();
+        size_t index;
+        for (index = 0; index < count; index++)
+            assert (batch [index] == (void *) expect++);
+    }
+    int64_t elapsed = zfl_time_now () - start;
+    zfl_thread_wait (producer);
+    zfl_thread_destroy (&producer);
+    zfl_ring_destroy (&test.ring);
+    return elapsed;
+}
+
+int
+zfl_ring_test (Bool verbose)
+{
+    zfl_ring_t
+        *ring;
+
+    printf (" * zfl_ring: ");
+
+    //  Both types behave the same from a single thread
+    int type;
+    for (type = ZFL_RING_SPSC; type <= ZFL_RING_MPMC; type++) {
+        ring = zfl_ring_new (5, type);
+        assert (ring);
+        assert (zfl_ring_size (ring) == 0);
+        assert (zfl_ring_pop (ring) == NULL);
+
+        //  Size rounds up to eight
+        size_t value;
+        for (value = 1; value <= 8; value++)
+            assert (zfl_ring_push (ring, (void *) value) == 0);
+        assert (zfl_ring_push (ring, (void *) value) == -1);
+        assert (zfl_ring_size (ring) == 8);
+        for (value = 1; value <= 3; value++)
+            assert (zfl_ring_pop (ring) == (void *) value);
+
+        //  Batches take what fits, and wrap around the ring
+        void *batch [10];
+        for (value = 0; value < 10; value++)
+            batch [value] = (void *) (value + 9);
+        assert (zfl_ring_push_batch (ring, batch, 10) == 3);
+        assert (zfl_ring_pop_batch (ring, batch, 10) == 8);
+        for (value = 0; value < 8; value++)
+            assert (batch [value] == (void *) (value + 4));
+        assert (zfl_ring_pop_batch (ring, batch, 10) == 0);
+        assert (zfl_ring_size (ring) == 0);
+
+        zfl_ring_destroy (&ring);
+        assert (ring == NULL);
+    }
+
+    //  Producers and consumers on an MPMC ring see every value once, in
+    //  order per producer. Once producers are done, we push one done marker
+    //  per consumer.
+    ring = zfl_ring_new (256, ZFL_RING_MPMC);
+    test_args_t producers [TEST_PRODUCERS];
+    test_args_t consumers [TEST_CONSUMERS];
+    zfl_thread_t *threads [TEST_PRODUCERS + TEST_CONSUMERS];
+    int thread_nbr;
+    for (thread_nbr = 0; thread_nbr < TEST_CONSUMERS; thread_nbr++) {
+        memset (&consumers [thread_nbr], 0, sizeof (test_args_t));
+        consumers [thread_nbr].ring = ring;
+        threads [thread_nbr] = zfl_thread_new (s_test_consumer, &consumers [thread_nbr]);
+    }
+    for (thread_nbr = 0; thread_nbr < TEST_PRODUCERS; thread_nbr++) {
+        memset (&producers [thread_nbr], 0, sizeof (test_args_t));
+        producers [thread_nbr].ring = ring;
+        producers [thread_nbr].first = thread_nbr * TEST_VALUES * 2 + 1;
+        producers [thread_nbr].last = thread_nbr * TEST_VALUES * 2 + TEST_VALUES / 10;
+        threads [TEST_CONSUMERS + thread_nbr]
+            = zfl_thread_new (s_test_producer, &producers [thread_nbr]);
+    }
+    size_t expect_count = 0;
+    size_t expect_sum = 0;
+    for (thread_nbr = 0; thread_nbr < TEST_PRODUCERS; thread_nbr++) {
+        zfl_thread_wait (threads [TEST_CONSUMERS + thread_nbr]);
+        zfl_thread_destroy (&threads [TEST_CONSUMERS + thread_nbr]);
+        size_t value;
+        for (value = producers [thread_nbr].first; value <= producers [thread_nbr].last; value++) {
+            expect_count++;
+            expect_sum += value;
+        }
+    }
+    for (thread_nbr = 0; thread_nbr < TEST_CONSUMERS; thread_nbr++) {
+        void *marker = (void *) ((size_t) (thread_nbr + 1) * TEST_VALUES * 2);
+        while (zfl_ring_push (ring, marker))
+            s_test_yield ();
+    }
+    size_t count = 0;
+    size_t sum = 0;
+    for (thread_nbr = 0; thread_nbr < TEST_CONSUMERS; thread_nbr++) {
+        zfl_thread_wait (threads [thread_nbr]);
+        zfl_thread_destroy (&threads [thread_nbr]);
+        count += consumers [thread_nbr].count;
+        sum += consumers [thread_nbr].sum;
+    }
+    assert (count == expect_count);
+    assert (sum == expect_sum);
+    assert (zfl_ring_size (ring) == 0);
+    zfl_ring_destroy (&ring);
+
+    //  The rest is benchmarking, which takes a while, so we only do it
+    //  when verbose, since that's when we report the results
+    if (!verbose) {
+        printf ("OK\n");
+        return 0;
+    }
+    //  Benchmark against passing pointers over inproc sockets
+    int64_t spsc_usecs = s_test_ring_throughput (ZFL_RING_SPSC);
+    int64_t mpmc_usecs = s_test_ring_throughput (ZFL_RING_MPMC);
+
+    test_args_t test = { NULL };
+    test.context = zmq_init (1);
+    assert (test.context);
+    void *socket = zmq_socket (test.context, ZMQ_PAIR);
+    int rc = zmq_bind (socket, TEST_ENDPOINT);
+    assert (rc == 0);
+    test.first = 1;
+    test.last = TEST_VALUES;
+    int64_t start = zfl_time_now ();
+    zfl_thread_t *thread = zfl_thread_new (s_test_inproc_producer, &test);
+    size_t expect;
+    for (expect = 1; expect <= TEST_VALUES; expect++) {
+        zmq_msg_t message;
+        zmq_msg_init (&message);
+        rc = zmq_recv (socket, &message, 0);
+        assert (rc == 0);
+        assert (memcmp (zmq_msg_data (&message), &expect, sizeof (void *)) == 0);
+        zmq_msg_close (&message);
+    }
+    int64_t inproc_usecs = zfl_time_now () - start;
+    zfl_thread_wait (thread);
+    zfl_thread_destroy (&thread);
+
+    //  Round trip latency, ring versus inproc
+    test.ring = zfl_ring_new (16, ZFL_RING_SPSC);
+    test.reply = zfl_ring_new (16, ZFL_RING_SPSC);
+    start = zfl_time_now ();
+    thread = zfl_thread_new (s_test_ring_echo, &test);
+    int round;
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        rc = zfl_ring_push (test.ring, &test);
+        assert (rc == 0);
+        void *value;
+        while ((value = zfl_ring_pop (test.reply)) == NULL)
+            s_test_yield ();
+        assert (value == &test);
+    }
+    int64_t ring_rtt_usecs = zfl_time_now () - start;
+    zfl_thread_wait (thread);
+    zfl_thread_destroy (&thread);
+    zfl_ring_destroy (&test.ring);
+    zfl_ring_destroy (&test.reply);
+
+    start = zfl_time_now ();
+    thread = zfl_thread_new (s_test_inproc_echo, &test);
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        zmq_msg_t message;
+        zmq_msg_init_size (&message, sizeof (void *));
+        rc = zmq_send (socket, &message, 0);
+        assert (rc == 0);
+        zmq_msg_close (&message);
+        zmq_msg_init (&message);
+        rc = zmq_recv (socket, &message, 0);
+        assert (rc == 0);
+        zmq_msg_close (&message);
+    }
+    int64_t inproc_rtt_usecs = zfl_time_now () - start;
+    zfl_thread_wait (thread);
+    zfl_thread_destroy (&thread);
+    zmq_close (socket);
+    zmq_term (test.context);
+
+    printf ("%d values: spsc %d, mpmc %d, inproc %d msecs; "
+            "%d round trips: ring %d, inproc %d msecs, ",
+        TEST_VALUES, (int) (spsc_usecs / 1000),
+        (int) (mpmc_usecs / 1000), (int) (inproc_usecs / 1000),
+        TEST_ROUNDS, (int) (ring_rtt_usecs / 1000),
+        (int) (inproc_rtt_usecs / 1000));
+    printf ("OK\n");
+    return 0;
+}
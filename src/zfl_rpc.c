@@ -27,10 +27,12 @@
 
 #include <zmq.h>
 #include "../include/zfl_prelude.h"
+#include "../include/zfl_pool.h"
 #include "../include/zfl_hash.h"
 #include "../include/zfl_list.h"
 #include "../include/zfl_msg.h"
 #include "../include/zfl_thread.h"
+#include "../include/zfl_time.h"
 #include "../include/zfl_rpc.h"
 
 //  Heartbeat rate (in microseconds)
@@ -58,8 +60,11 @@ typedef struct {
         *server_id;
     int
         alive;                  //  True iff server's heart is beating
-    uint64_t
+    int64_t
         heartbeat_deadline;     //  Until when we wait for heartbeat
+    zfl_list_handle_t
+        *alive_handle,          //  Node in alive_servers, if alive
+        *lru_handle;            //  Node in lru_queue, if alive
 } server_t;
 
 //  Allocate and initialize a new server object
@@ -101,7 +106,7 @@ typedef struct {
         *request;               //  Pending request or NULL
     server_t
         *current_server;        //  Server processing the last request or NULL
-    uint64_t
+    int64_t
         next_heartbeat,         //  Time of next heartbeat
         processing_deadline;    //  Until when we wait for result
 } rpc_t;
@@ -118,28 +123,6 @@ typedef struct {
 } thread_args_t;
 
 
-//  --------------------------------------------------------------------------
-//  Return current time (in microseconds)
-//	This code should go into a zfl_time class
-
-static uint64_t
-s_now (void)
-{
-#if (defined (__UNIX__))
-    struct timeval tv;
-    int rc = gettimeofday (&tv, NULL);
-    assert (rc == 0);
-    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
-#elif (defined (__WINDOWS__))
-    SYSTEMTIME st;
-    GetSystemTime (&st);
-    return (uint64_t) st.wSecond * 1000000 + st.wMilliseconds * 1000;
-#else
-#   error "zfl_rpc does not compile on this system"
-#endif
-}
-
-
 //  --------------------------------------------------------------------------
 //  Handle message received from a server
 
@@ -156,14 +139,14 @@ s_backend_event (rpc_t *rpc)
 
     if (zfl_msg_parts (msg) == 0) {
         //  Heartbeat signal
+        server->heartbeat_deadline = zfl_time_now () + HEARTBEAT_INTERVAL;
         if (server->alive)
-            zfl_list_remove (rpc->alive_servers, server);
+            zfl_list_move_tail (rpc->alive_servers, server->alive_handle);
         else {
-            zfl_list_append (rpc->lru_queue, server);
+            server->lru_handle = zfl_list_append (rpc->lru_queue, server);
+            server->alive_handle = zfl_list_append (rpc->alive_servers, server);
             server->alive = 1;
         }
-        server->heartbeat_deadline = s_now () + HEARTBEAT_INTERVAL;
-        zfl_list_append (rpc->alive_servers, server);
     }
     else
     if (zfl_msg_parts (msg) == 2) {
@@ -257,20 +240,15 @@ s_control_event (rpc_t *rpc)
 static void
 s_send_heartbeat (rpc_t *rpc)
 {
-    zfl_list_t *servers = zfl_list_copy (rpc->servers);
-    assert (servers);
-
-    while (zfl_list_size (servers) > 0) {
-        server_t *server = (server_t *) zfl_list_first (servers);
-        zfl_list_remove (servers, server);
-
+    server_t *server = (server_t *) zfl_list_first (rpc->servers);
+    while (server) {
         //  Prepare and send out heartbeat message
         zfl_msg_t *msg = zfl_msg_new ();
         assert (msg);
         zfl_msg_wrap (msg, server->server_id, "");
         zfl_msg_send (&msg, rpc->backend);
+        server = (server_t *) zfl_list_next (rpc->servers);
     }
-    zfl_list_destroy (&servers);
 }
 
 
@@ -311,7 +289,7 @@ s_rpc_thread (void *arg)
     rpc->registry = zfl_hash_new ();
     assert (rpc->registry);
 
-    rpc->next_heartbeat = s_now ();
+    rpc->next_heartbeat = zfl_time_now ();
 
     //  Controls how long we wait for message. Updated during processing.
     long poll_timeout = -1;
@@ -342,7 +320,7 @@ s_rpc_thread (void *arg)
             stopped = s_control_event (rpc);
 
         //  Get current time
-        uint64_t now = s_now ();
+        int64_t now = zfl_time_now ();
 
         //  Time for heartbeat?
         if (now >= rpc->next_heartbeat) {
@@ -355,8 +333,8 @@ s_rpc_thread (void *arg)
             server_t *server = (server_t *) zfl_list_first (rpc->alive_servers);
             if (now < server->heartbeat_deadline)
                 break;
-            zfl_list_remove (rpc->alive_servers, server);
-            zfl_list_remove (rpc->lru_queue, server);
+            zfl_list_remove_handle (rpc->alive_servers, server->alive_handle);
+            zfl_list_remove_handle (rpc->lru_queue, server->lru_handle);
             server->alive = 0;
         }
 
@@ -387,8 +365,7 @@ s_rpc_thread (void *arg)
                 rpc->processing_deadline = now + MAX_PROCESSING_TIME;
 
                 //  Move the server at the end of the LRU queue
-                zfl_list_remove (rpc->lru_queue, server);
-                zfl_list_append (rpc->lru_queue, server);
+                zfl_list_move_tail (rpc->lru_queue, server->lru_handle);
             }
         }
 
@@ -26,10 +26,13 @@
 
 #include <zmq.h>
 #include "../include/zfl_prelude.h"
+#include "../include/zfl_pool.h"
 #include "../include/zfl_hash.h"
 #include "../include/zfl_list.h"
+#include "../include/zfl_queue.h"
 #include "../include/zfl_msg.h"
 #include "../include/zfl_thread.h"
+#include "../include/zfl_time.h"
 #include "../include/zfl_rpcd.h"
 
 //  How often we should check for heartbeat signal
@@ -55,8 +58,11 @@ typedef struct {
     int
         server_busy;    //  indicates whether the server waits for response
     zfl_list_t
-        *clients,       //  list of all connected clients
+        *clients;       //  list of all connected clients
+    zfl_queue_t
         *msg_queue;     //  queue of pending requests
+    zfl_msg_t
+        *reply;         //  reused for each response from server
     zfl_hash_t
         *registry;      //  used to lookup client using the ID
 } rpcd_t;
@@ -77,44 +83,29 @@ typedef struct {
 //  Used to keep track of connected clients
 
 struct client {
-    char
-        *client_id;     //  client ID
-    uint64_t
+    byte
+        *client_id;     //  client ID, as binary 0MQ identity
+    size_t
+        id_size;        //  size of client ID
+    int64_t
         timestamp;      //  time we received the last request or heartbeat
+    zfl_list_handle_t
+        *handle;        //  node in list of clients
 };
 
 
-//  --------------------------------------------------------------------------
-//  Return current time (in microseconds)
-//	This code should go into a zfl_time class
-
-static uint64_t
-s_now (void)
-{
-#if (defined (__UNIX__))
-    struct timeval tv;
-    int rc = gettimeofday (&tv, NULL);
-    assert (rc == 0);
-    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
-#elif (defined (__WINDOWS__))
-    SYSTEMTIME st;
-    GetSystemTime (&st);
-    return (uint64_t) st.wSecond * 1000000 + st.wMilliseconds * 1000;
-#else
-#   error "zfl_rpc does not compile on this system"
-#endif
-}
-
-
 //  --------------------------------------------------------------------------
 //  Creates new client
 
 static struct client *
-s_client_new (char *id)
+s_client_new (byte *id, size_t id_size)
 {
     struct client *client = (struct client *) zmalloc (sizeof (struct client));
-    client->client_id = strdup (id);
-    client->timestamp = s_now ();
+    client->client_id = (byte *) malloc (id_size);
+    assert (client->client_id);
+    memcpy (client->client_id, id, id_size);
+    client->id_size = id_size;
+    client->timestamp = zfl_time_now ();
     return client;
 }
 
@@ -134,6 +125,9 @@ s_client_destroy (struct client **self_p)
 
 //  --------------------------------------------------------------------------
 //  Handle message from a client
+//  We work with client identities as the binary 0MQ identities they
+//  arrive as, and key the registry on them, so that we never format an
+//  identity as a string, nor parse it back, on the way through.
 
 static void
 s_frontend_event (rpcd_t *rpcd)
@@ -141,30 +135,34 @@ s_frontend_event (rpcd_t *rpcd)
     zfl_msg_t *msg = zfl_msg_recv (rpcd->frontend);
     assert (msg);
     assert (zfl_msg_parts (msg) > 0);
+    zfl_msg_set_binary_ids (msg, TRUE);
 
-    char *client_id = zfl_msg_unwrap (msg);
+    size_t id_size = zfl_msg_address_size (msg);
+    byte *client_id = (byte *) zfl_msg_unwrap (msg);
     assert (client_id);
 
-    struct client *client = (struct client *) zfl_hash_lookup (rpcd->registry, client_id);
+    struct client *client = (struct client *)
+        zfl_hash_lookup_bin (rpcd->registry, client_id, id_size);
     if (client == NULL) {
-        client = s_client_new (client_id);
+        client = s_client_new (client_id, id_size);
         assert (client);
-        zfl_list_append (rpcd->clients, client);
-        zfl_hash_insert (rpcd->registry, client->client_id, client);
+        client->handle = zfl_list_append (rpcd->clients, client);
+        zfl_hash_insert_bin (rpcd->registry,
+            client->client_id, client->id_size, client);
     }
     if (zfl_msg_parts (msg) > 0) {
         //  Queue message
-        zfl_msg_wrap (msg, client_id, NULL);
-        zfl_list_append (rpcd->msg_queue, msg);
+        zfl_msg_push_data (msg, client_id, id_size);
+        zfl_queue_append (rpcd->msg_queue, msg);
     }
     else {
         //  Echo heartbeat
-        zfl_msg_wrap (msg, client_id, "");
+        zfl_msg_push (msg, "");
+        zfl_msg_push_data (msg, client_id, id_size);
         zfl_msg_send (&msg, rpcd->frontend);
     }
-    client->timestamp = s_now ();
-    zfl_list_remove (rpcd->clients, client);
-    zfl_list_append (rpcd->clients, client);
+    client->timestamp = zfl_time_now ();
+    zfl_list_move_tail (rpcd->clients, client->handle);
     free (client_id);
 }
 
@@ -175,10 +173,9 @@ s_frontend_event (rpcd_t *rpcd)
 static void
 s_backend_event (rpcd_t *rpcd)
 {
-    zfl_msg_t *msg = zfl_msg_recv (rpcd->backend);
-    assert (msg);
+    zfl_msg_recv_into (rpcd->reply, rpcd->backend);
     assert (rpcd->server_busy);
-    zfl_msg_send (&msg, rpcd->frontend);
+    zfl_msg_send_keep (rpcd->reply, rpcd->frontend);
     rpcd->server_busy = 0;
 }
 
@@ -264,8 +261,10 @@ s_rpcd_thread (void *arg)
     assert (rpcd->registry);
 
     //  No requests pending
-    rpcd->msg_queue = zfl_list_new ();
+    rpcd->msg_queue = zfl_queue_new ();
     assert (rpcd->msg_queue);
+    rpcd->reply = zfl_msg_new ();
+    zfl_msg_set_binary_ids (rpcd->reply, TRUE);
 
     //  Controls thread termination.
     int stopped = 0;
@@ -298,24 +297,24 @@ s_rpcd_thread (void *arg)
             stopped = s_control_event (rpcd);
 
         //  get current time
-        uint64_t now = s_now ();
+        int64_t now = zfl_time_now ();
 
         while (zfl_list_size (rpcd->clients) > 0) {
             struct client *client = (struct client *) zfl_list_first (rpcd->clients);
             assert (client);
             if (now < client->timestamp + HEARTBEAT_INTERVAL)
                 break;
-            zfl_list_remove (rpcd->clients, client);
-            zfl_hash_delete (rpcd->registry, client->client_id);
+            zfl_list_remove_handle (rpcd->clients, client->handle);
+            zfl_hash_delete_bin (rpcd->registry,
+                client->client_id, client->id_size);
             s_client_destroy (&client);
         }
 
         //  If there is a message in the message queue, forward
         //  it to the server
-        if (zfl_list_size (rpcd->msg_queue) > 0) {
+        if (zfl_queue_size (rpcd->msg_queue) > 0) {
             if (!rpcd->server_busy) {
-                zfl_msg_t *msg = (zfl_msg_t *) zfl_list_first (rpcd->msg_queue);
-                zfl_list_remove (rpcd->msg_queue, msg);
+                zfl_msg_t *msg = (zfl_msg_t *) zfl_queue_pop (rpcd->msg_queue);
                 zfl_msg_send (&msg, rpcd->backend);
                 rpcd->server_busy = 1;
             }
@@ -342,16 +341,16 @@ s_rpcd_thread (void *arg)
     }
 
     //  Free all queued messages
-    while (zfl_list_size (rpcd->msg_queue) > 0) {
-        zfl_msg_t *msg = (zfl_msg_t *) zfl_list_first (rpcd->msg_queue);
-        zfl_list_remove (rpcd->msg_queue, msg);
+    while (zfl_queue_size (rpcd->msg_queue) > 0) {
+        zfl_msg_t *msg = (zfl_msg_t *) zfl_queue_pop (rpcd->msg_queue);
         zfl_msg_destroy (&msg);
     }
 
     //  Destroy data structures
     zfl_list_destroy (&rpcd->clients);
     zfl_hash_destroy (&rpcd->registry);
-    zfl_list_destroy (&rpcd->msg_queue);
+    zfl_queue_destroy (&rpcd->msg_queue);
+    zfl_msg_destroy (&rpcd->reply);
 
     free (rpcd);
 
@@ -25,18 +25,25 @@
 */
 
 #include "../include/zfl_prelude.h"
+#include "../include/zfl_pool.h"
 #include "../include/zfl_base.h"
 #include "../include/zfl_blob.h"
+#include "../include/zfl_chash.h"
 #include "../include/zfl_config.h"
 #include "../include/zfl_config_json.h"
 #include "../include/zfl_config_zpl.h"
 #include "../include/zfl_device.h"
 #include "../include/zfl_hash.h"
 #include "../include/zfl_list.h"
+#include "../include/zfl_lru.h"
 #include "../include/zfl_msg.h"
+#include "../include/zfl_blob_reader.h"
+#include "../include/zfl_queue.h"
+#include "../include/zfl_ring.h"
 #include "../include/zfl_rpc.h"
 #include "../include/zfl_rpcd.h"
 #include "../include/zfl_thread.h"
+#include "../include/zfl_time.h"
 
 int main (int argc, char *argv [])
 {
@@ -53,16 +60,23 @@ int main (int argc, char *argv [])
 
     zfl_base_test (verbose);
     zfl_blob_test (verbose);
+    zfl_blob_reader_test (verbose);
+    zfl_chash_test (verbose);
     zfl_config_test (verbose);
     zfl_config_json_test (verbose);
     zfl_config_zpl_test (verbose);
     zfl_device_test (verbose);
     zfl_hash_test (verbose);
     zfl_list_test (verbose);
+    zfl_lru_test (verbose);
     zfl_msg_test (verbose);
+    zfl_pool_test (verbose);
+    zfl_queue_test (verbose);
+    zfl_ring_test (verbose);
     zfl_rpc_test (verbose);
     zfl_rpcd_test (verbose);
     zfl_thread_test (verbose);
+    zfl_time_test (verbose);
 
     printf ("Tests passed OK\n");
     return 0;
@@ -0,0 +1,98 @@
+/*  =========================================================================
+    zfl_time.c - time functions
+
+    Provides a monotonic clock in microseconds, for timeouts, heartbeats and
+    measuring elapsed time. The clock has no fixed epoch and does not move
+    when the system time is changed, so it is not useful as a date.
+
+    -------------------------------------------------------------------------
+    Copyright (c) 1991-2011 iMatix Corporation <www.imatix.com>
+    Copyright other contributors as noted in the AUTHORS file.
+
+    This file is part of the ZeroMQ Function Library: http://zfl.zeromq.org
+
+    This is free software; you can redistribute it and/or modify it under the
+    terms of the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your option)
+    any later version.
+
+    This software is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABIL-
+    ITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+    Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+    =========================================================================
+*/
+
+#include "../include/zfl_prelude.h"
+#include "../include/zfl_time.h"
+
+
+//  --------------------------------------------------------------------------
+//  Returns the current time in microseconds, from a monotonic clock. Use
+//  this to measure intervals; the value on its own means nothing. Where
+//  the system has no monotonic clock, falls back to the time of day.
+
+int64_t
+zfl_time_now (void)
+{
+#if defined (__UNIX__)
+#   if defined (CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+        return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#   endif
+    struct timeval tv;
+    int rc = gettimeofday (&tv, NULL);
+    assert (rc == 0);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#elif defined (__WINDOWS__)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER count;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency (&frequency);
+    QueryPerformanceCounter (&count);
+    return (int64_t) (count.QuadPart / frequency.QuadPart) * 1000000
+         + (int64_t) (count.QuadPart % frequency.QuadPart) * 1000000
+                   / frequency.QuadPart;
+#else
+#   error "Platform not supported by zfl_time class"
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+int
+zfl_time_test (Bool verbose)
+{
+    printf (" * zfl_time: ");
+
+    //  The clock never goes backwards
+    int64_t start = zfl_time_now ();
+    assert (start > 0);
+    int64_t last = start;
+    int count;
+    for (count = 0; count < 1000; count++) {
+        int64_t now = zfl_time_now ();
+        assert (now >= last);
+        last = now;
+    }
+    //  And it measures time in microseconds
+#if defined (__UNIX__)
+    usleep (10000);
+#elif defined (__WINDOWS__)
+    Sleep (10);
+#endif
+    int64_t elapsed = zfl_time_now () - start;
+    assert (elapsed >= 10000);
+    assert (elapsed < 10000000);
+    if (verbose)
+        printf ("slept 10 msecs, measured %d usecs ", (int) elapsed);
+
+    printf ("OK\n");
+    return 0;
+}